@@ -26,6 +26,8 @@ AsymptoticExclusion::AsymptoticExclusion(ProfileLikelihood *pl, double confidenc
 	
 	useQtilde =  false;	
 
+	sigmaAsimovMode = SIGMA_ASIMOV_SCAN;
+
 	AlternativeX = -999;
 
 	Obslimit=-999;
@@ -44,12 +46,15 @@ void AsymptoticExclusion::generateAndSetAsimov(double mu_prime) {
 
  plike->setData(ASIMOV_DATA); 	  // set the data to use as observed data.
 
+ plike->clearWarmStartPoints();    // the converged fits refer to the previous data
+
 }
 
 
 void AsymptoticExclusion::setRealData() {
 
 	 plike->setData(DM_DATA);
+	 plike->clearWarmStartPoints();
 }
 
 
@@ -57,6 +62,7 @@ void AsymptoticExclusion::setToyDataset(double seed, double mu_prime){
 
 	plike->generateToyDataset(seed, mu_prime);  //trigger the run to generated data and store in DM_SIMULATED_DATA
 	plike->setData(DM_SIMULATED_DATA);
+	plike->clearWarmStartPoints();
 
 }
 
@@ -120,6 +126,12 @@ double AsymptoticExclusion::computeSigmaAsimov(double mu_prime){
 
   generateAndSetAsimov(mu_prime);	// tell plike to set reference data to Asimov
 
+  double sigma_hesse = UNDEFINED;
+  if(sigmaAsimovMode != SIGMA_ASIMOV_SCAN) {
+	sigma_hesse = computeSigmaAsimovHesse();
+	if(sigmaAsimovMode == SIGMA_ASIMOV_HESSE && sigma_hesse != UNDEFINED) return sigma_hesse;
+	if(sigma_hesse == UNDEFINED) cout << "AsymptoticExclusion::computeSigmaAsimov - WARNING : Hesse failed, using the scan" << endl;
+  }
 
 
   //LOOP: scan over mu values and compute several times sigma_A, this depends sightly
@@ -162,10 +174,27 @@ double AsymptoticExclusion::computeSigmaAsimov(double mu_prime){
   }
   if(counter > 0) sigma_A = sigma_A / counter;  // just average  
 
+  if(sigmaAsimovMode == SIGMA_ASIMOV_VALIDATE && sigma_hesse != UNDEFINED)
+	cout << "AsymptoticExclusion::computeSigmaAsimov - INFO : sigma_A scan " << sigma_A << "  Hesse " << sigma_hesse 
+	     << "  relative difference " << (sigma_hesse - sigma_A) / sigma_A << endl;
+
   return sigma_A ;
 }
 
 
+double AsymptoticExclusion::computeSigmaAsimovHesse(){
+
+  // for the Asimov dataset the inverse of the Hesse matrix at the best fit is the
+  // covariance of the estimators, its POI element is sigma_A^2
+  plike->resetParameters();
+  plike->maximize(false);
+
+  if(!plike->computeHesse()) return UNDEFINED;
+
+  return plike->getPOI()->getSigma();
+}
+
+
 double AsymptoticExclusion::conditionalFit(double mu){
   //Do the conditional fit
   plike->setParameterValue(PAR_SIGMA, mu);  // set signal strenght to mu
@@ -212,8 +241,27 @@ void AsymptoticExclusion::computeSensitivity() {
 	// N_sigma_band = +-N*sigma_0 + sigma_0 * Inverse_PHI(1- cl*PHI(+-N)) 
 	// where PHI is the cumulative of Normal(0,1) from [-Inf : x], and cl is confidence level
 
-	double ex_POI      =  computeSensitivityHagar();  //COMMENT
-	double sigma_0     =  ex_POI / sqrt(ROOT::Math::normal_quantile(1-cl,1)); //COMMENT 
+	double ex_POI      =  UNDEFINED;
+	double sigma_0     =  UNDEFINED;
+
+	// with Hesse, sigma_0 comes from a single fit to the Asimov dataset and the
+	// asymptotic limit is where q = z^2 (see returnLimitHagar), that is mu = sigma_0 * z
+	if(sigmaAsimovMode == SIGMA_ASIMOV_HESSE) {
+		sigma_0 = computeSigmaAsimov(0.);
+		ex_POI  = sigma_0 * ROOT::Math::normal_quantile(1-cl,1);
+	}
+	else {
+		ex_POI      =  computeSensitivityHagar();  //COMMENT
+		sigma_0     =  ex_POI / sqrt(ROOT::Math::normal_quantile(1-cl,1)); //COMMENT 
+
+		if(sigmaAsimovMode == SIGMA_ASIMOV_VALIDATE) {
+			generateAndSetAsimov(0.);
+			double sigma_hesse = computeSigmaAsimovHesse();
+			double sigma_limit = ex_POI / ROOT::Math::normal_quantile(1-cl,1);
+			cout << "AsymptoticExclusion::computeSensitivity - INFO : sigma_0 from the limit " << sigma_limit << "  Hesse " << sigma_hesse
+			     << "  relative difference " << (sigma_hesse - sigma_limit) / sigma_limit << endl;
+		}
+	}
 	// the new way
 	double ex_hagar      = XsecScale * ex_POI; //COMMENT
 
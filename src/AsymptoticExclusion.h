@@ -9,6 +9,11 @@
 using namespace ROOT;
 using namespace Math;
 
+enum sigmaAsimovModes { SIGMA_ASIMOV_SCAN       // average of |mu - mu'|/sqrt(q) over a scan of conditional fits
+                      , SIGMA_ASIMOV_HESSE      // error on mu_hat from the Hesse matrix of the unconditional fit
+                      , SIGMA_ASIMOV_VALIDATE   // both, the scan is used and compared to Hesse
+                      } ;
+
 /**
   * Computes limits with the asymptotic formulae, default is CLs.
   * Output: root files with histograms for a single mass point, several files can be hadd togheter. This is to promote parallelization.
@@ -94,6 +99,12 @@ class AsymptoticExclusion : public XeStat{
     */
 	double computeSigmaAsimov(double mu_prime);
 
+    /**
+      * Set how sigma_A is computed by computeSigmaAsimov() and computeSensitivity(),
+	default is SIGMA_ASIMOV_SCAN. SIGMA_ASIMOV_HESSE needs a single fit to the Asimov dataset.
+    */
+	void setSigmaAsimovMode(int mode) {sigmaAsimovMode = mode;};
+
 
     /**
       * Set the number of scan points for the limit compyutation, default is 100.
@@ -151,6 +162,12 @@ class AsymptoticExclusion : public XeStat{
     */
         void computeSetAsimovSigma();
 
+    /**
+      * sigma_A as the Hesse error on mu_hat, for the Asimov dataset currently set.
+	Returns UNDEFINED if Hesse fails.
+    */
+	double computeSigmaAsimovHesse();
+
 	ProfileLikelihood *plike;		// handler on profile likelihood
 
 	double Obslimit, ObslimitnoCLS;
@@ -182,6 +199,8 @@ class AsymptoticExclusion : public XeStat{
 
 	bool 		     useQtilde;
 
+	int 		     sigmaAsimovMode;
+
 	double               AlternativeX;
 
 };
@@ -14,6 +14,10 @@ ToyFitterExclusion::ToyFitterExclusion(TString CollectionName):errorHandler("Toy
     likelihood_uncond = 0.;
     likelihood_cond = 0.;
     limit_converged = false;
+    limitFinder     = LIMIT_FINDER_BRENT;
+    limitTolerance  = 0.01;
+    limit_fits      = 0;
+    conditionalFits = 0;
     testStat_limit  = 0.;
     name_params.clear();
     CurrentTreeIndex = 0;
@@ -32,11 +36,11 @@ ToyFitterExclusion::ToyFitterExclusion(TString CollectionName):errorHandler("Toy
     Gen = UNDEFINED_INT;
 }
 
-void ToyFitterExclusion::for_each_tree( double (ToyFitterExclusion::*p2method)(double), TTree *outTree,  double mu, int stopAt){
+void ToyFitterExclusion::for_each_tree( double (ToyFitterExclusion::*p2method)(double), TTree *outTree,  const vector<double> &mus, int stopAt, toyQueue *queue){
     
 
     // setting up branches on outTree
-    mu_fit    = mu;
+    mu_fit    = mus[0];
     testStat = 0.;
     q_tilde  = 0.;
     int inputTreeIndex = -9;
@@ -58,10 +62,30 @@ void ToyFitterExclusion::for_each_tree( double (ToyFitterExclusion::*p2method)(d
     outTree->Branch("inputTreeIndex", &inputTreeIndex, "inputTreeIndex/I");
     outTree->Branch("generation", &Gen, "generation/I");
 
-    // reset CurrentTreeIndex
+    // reset CurrentTreeIndex, and the unconditional fit of a previous call
     CurrentTreeIndex = 0;
+    IndexHolder = -9;
+
+    pdfLikelihood *pdfLike = NULL;
+    if(queue != NULL) {
+        pdfLike = dynamic_cast<pdfLikelihood*>(likeHood);
+        if(pdfLike == NULL) Error("for_each_tree", "toys in memory need a pdfLikelihood.");
+    }
+
+    generatedToy *toy = NULL;
 
-    while ( CurrentTreeIndex < stopAt ) {
+    while ( queue != NULL ? queue->pop(toy) : CurrentTreeIndex < stopAt ) {
+
+        if(queue != NULL) {
+            // set the toy handed by the generator, no file involved
+            CurrentTreeIndex = toy->toyItr;
+            pdfLike->setToyEvents(toy->toyItr, toy->data.cs1, toy->data.cs2, toy->data.params, false, toy->data.count);
+            if(toy->withCalibration && pdfLike->withSafeGuard)
+                pdfLike->setToyEvents(toy->toyItr, toy->calibration.cs1, toy->calibration.cs2, toy->calibration.params, true);
+            delete toy;
+        }
+        // set toy data for fit (except case is only one dataset, like you are fitting data)
+        else if(stopAt != 1) likeHood->setTreeIndex(CurrentTreeIndex);
         
         Info("fit", TString::Format("Fitting tree index, %d", CurrentTreeIndex));
 
@@ -70,12 +94,12 @@ void ToyFitterExclusion::for_each_tree( double (ToyFitterExclusion::*p2method)(d
         // fill true values from generated tree
         fillTrueParams(); 
 
-        // set toy data for fit (except case is only one dataset, like you are fitting data)
-        if(stopAt != 1) likeHood->setTreeIndex(CurrentTreeIndex);
-
         // reset the parameter to their nominal initial value (othrwise takes longer to fit)
         likeHood->resetParameters();
 
+        // the conditional fits of the previous tree are not a good start for this one
+        likeHood->clearWarmStartPoints();
+
         // Dice the measured parameters (note that if a parameter is free the t-value exytacted here has no effect)
         // Note: this MUST be called after "fillTrueParams"
         if(randomizeMeasure) measureParameters();
@@ -83,9 +107,12 @@ void ToyFitterExclusion::for_each_tree( double (ToyFitterExclusion::*p2method)(d
         // Fancy coding isn't it? ;)  
         // This is a functional: using a pointer to a function of ToyFitterExclusion
         // so that we can run this same loop for different purposes
-        testStat = (this->*p2method)(mu);
-        
-        outTree->Fill();
+        for(unsigned int muItr = 0; muItr < mus.size(); muItr++){
+            mu_fit   = mus[muItr];
+            testStat = (this->*p2method)(mu_fit);
+
+            outTree->Fill();
+        }
 
         CurrentTreeIndex++;
     }
@@ -101,7 +128,7 @@ void ToyFitterExclusion::fit(double mu, int stopAt){
     TTree *outTree = new TTree("post_fit_tree", "output tree for a given mu, hadd me");
 
     // read each tree in input file "f" nad applies the computeTS function to it 
-    for_each_tree( &ToyFitterExclusion::computeTS, outTree, mu, stopAt );
+    for_each_tree( &ToyFitterExclusion::computeTS, outTree, vector<double>(1, mu), stopAt );
         
     f_out.cd();
     outTree->Write();
@@ -109,6 +136,82 @@ void ToyFitterExclusion::fit(double mu, int stopAt){
 
 }
 
+void ToyFitterExclusion::fit(const vector<double> &mus, int stopAt){
+
+    if(mus.empty()) Error("fit", "the list of mu is empty.");
+
+    TFile f_out(OutDir + "post_fit_" + treeName + Suffix + ".root","RECREATE");
+
+    // output tree, here intentionally all out tree will have the same name so we can hadd
+    TTree *outTree = new TTree("post_fit_tree", "output tree for a given mu, hadd me");
+
+    // increasing mu, so that each conditional fit starts next to the previous one
+    vector<double> sorted_mus(mus);
+    sort(sorted_mus.begin(), sorted_mus.end());
+
+    int warmStartMode = likeHood->getWarmStart();
+    if(warmStartMode == WARM_START_OFF) likeHood->setWarmStart(WARM_START_NEAREST);
+
+    // computeTS does the unconditional fit only for the first mu of each tree
+    for_each_tree( &ToyFitterExclusion::computeTS, outTree, sorted_mus, stopAt );
+
+    likeHood->setWarmStart(warmStartMode);
+
+    f_out.cd();
+    outTree->Write();
+    f_out.Close();
+
+}
+
+
+
+void ToyFitterExclusion::fitGenerated(ToyGenerator *generator, double mu_true, const vector<double> &mus, int N, bool randomizeNP, int queueSize){
+
+    if(mus.empty()) Error("fitGenerated", "the list of mu is empty.");
+    if(randomizeNP && generator->getLikelihood() == likeHood)
+        Error("fitGenerated", "randomizing the NP needs a generator with its own likelihood.");
+
+    pdfLikelihood *pdfLike = dynamic_cast<pdfLikelihood*>(likeHood);
+    if(pdfLike == NULL) Error("fitGenerated", "toys in memory need a pdfLikelihood.");
+
+    TFile f_out(OutDir + "post_fit_" + treeName + Suffix + ".root","RECREATE");
+
+    // output tree, here intentionally all out tree will have the same name so we can hadd
+    TTree *outTree = new TTree("post_fit_tree", "output tree for a given mu, hadd me");
+
+    // increasing mu, so that each conditional fit starts next to the previous one
+    vector<double> sorted_mus(mus);
+    sort(sorted_mus.begin(), sorted_mus.end());
+
+    int warmStartMode = likeHood->getWarmStart();
+    if(warmStartMode == WARM_START_OFF) likeHood->setWarmStart(WARM_START_NEAREST);
+
+    // the generator keeps up to queueSize toys ahead of the fits
+    toyQueue queue(queueSize);
+    generator->startPipeline(queue, mu_true, N, randomizeNP, pdfLike->withSafeGuard);
+
+    try {
+        for_each_tree( &ToyFitterExclusion::computeTS, outTree, sorted_mus, N, &queue );
+    }
+    catch(...) {
+        // stop the generator before leaving
+        queue.close();
+        generatedToy *left = NULL;
+        while(queue.pop(left)) delete left;
+        generator->joinPipeline();
+        likeHood->setWarmStart(warmStartMode);
+        throw;
+    }
+
+    generator->joinPipeline();
+
+    likeHood->setWarmStart(warmStartMode);
+
+    f_out.cd();
+    outTree->Write();
+    f_out.Close();
+
+}
 
 
 void ToyFitterExclusion::spitTheLimit(TGraphAsymmErrors *ninety_quantiles, int stopAt){
@@ -133,9 +236,10 @@ void ToyFitterExclusion::spitTheLimit(TGraphAsymmErrors *ninety_quantiles, int s
     outTree->Branch("testStat_limit", &testStat_limit, "testStat_limit/D");
     outTree->Branch("testStat_at0", &testStat_at0, "testStat_at0/D");
     outTree->Branch("limit_converged", &limit_converged, "limit_converged/O");
+    outTree->Branch("limit_fits", &limit_fits, "limit_fits/I");
 
     // read each tree in input file "f" and applies the computeTS function to it 
-    for_each_tree( &ToyFitterExclusion::limitLoop, outTree, -9., stopAt );
+    for_each_tree( &ToyFitterExclusion::limitLoop, outTree, vector<double>(1, -9.), stopAt );
               
     f_out.cd();
     outTree->Write();
@@ -160,6 +264,7 @@ double ToyFitterExclusion::limitLoop(double initial_mu){
     lower_limit     = -1.;
     lower_mu_limit = -1.; 
     bool do_interval = false;
+    conditionalFits = 0;
 
     // Finding TS @ mu=0
     testStat_at0 = computeTS( 0. ) ;
@@ -177,6 +282,41 @@ double ToyFitterExclusion::limitLoop(double initial_mu){
     //                                                                                      //
     //////////////////////////////////////////////////////////////////////////////////////////
 
+    if(limitFinder == LIMIT_FINDER_ROOT) {
+
+        // q = 0 at mu_hat (or at 0 for mu_hat < 0), that is below the quantile
+        double mu_low = TMath::Max(mu_hat, 0.);
+
+        if(do_interval) {
+            // CASE IN WHICH WE COMPUTE FC INTERVALS, q decreases from TS(0) above the quantile to 0 at mu_hat
+            Info("limitLoop","WE GOT INTERVALS THIS TIME! Computing lower limit.");
+            double f_0 = testStat_at0 - quantileAt(0.);
+            double f_hat = -quantileAt(mu_hat);
+            lower_mu_limit = findCrossing(0., f_0, mu_hat, f_hat, mu_hat * f_0 / (f_0 - f_hat), mu_hat);
+            lower_limit = lower_mu_limit * likeHood->getSignalMultiplier() * likeHood->getSignalDefaultNorm();
+        }
+
+        // NORMAL CASE UPPER LIMIT, the fit at mu_hat + 1 is already a point of the search
+        double lo = mu_low, f_lo = -quantileAt(mu_low);
+        double hi = UNDEFINED, f_hi = 0.;
+        double f_one = one_over_sigma - quantileAt(mu_hat + 1.);
+        if(mu_hat + 1. > mu_low) {
+            if(f_one < 0.) { lo = mu_hat + 1.; f_lo = f_one; }
+            else           { hi = mu_hat + 1.; f_hi = f_one; }
+        }
+
+        double mu_max = likeHood->getParameter(PAR_SIGMA)->getMaximum();
+        double guess  = (mu_asym_best > lo && (hi == UNDEFINED || mu_asym_best < hi)) ? mu_asym_best : UNDEFINED;
+        mu_limit = findCrossing(lo, f_lo, hi, f_hi, guess, mu_max);
+        limit    = mu_limit * likeHood->getSignalMultiplier() * likeHood->getSignalDefaultNorm();
+        limit_fits = conditionalFits;
+
+        Info("limitLoop", TString::Format("%s with TS val= %1.3f after %d conditional fits", (limit_converged ? "CONVERGED" : "NOT - CONVERGED" ), testStat_limit, limit_fits ) );
+        Info("limitLoop",TString::Format("computed for Tree index %d ---> mu_limit= %f (~events) xsec = %E cm^2", CurrentTreeIndex, mu_limit, limit));
+
+        return testStat_limit;
+    }
+
     // from ROOT docs:  https://root.cern.ch/root/html/ROOT__Math__BrentMinimizer1D.html
     //                  https://root.cern.ch/numerical-minimization
     //                  https://root.cern.ch/how-implement-mathematical-function-inside-framework
@@ -204,8 +344,9 @@ double ToyFitterExclusion::limitLoop(double initial_mu){
 
     mu_limit = bm.XMinimum();
     limit    = mu_limit * likeHood->getSignalMultiplier() * likeHood->getSignalDefaultNorm();
+    limit_fits = conditionalFits;
 
-    Info("limitLoop", TString::Format("%s with TS val= %1.3f", (limit_converged ? "CONVERGED" : "NOT - CONVERGED" ), q_stat ) );
+    Info("limitLoop", TString::Format("%s with TS val= %1.3f after %d conditional fits", (limit_converged ? "CONVERGED" : "NOT - CONVERGED" ), q_stat, limit_fits ) );
     Info("limitLoop",TString::Format("computed for Tree index %d ---> mu_limit= %f (~events) xsec = %E cm^2", CurrentTreeIndex, mu_limit, limit));
     
     return q_stat;
@@ -237,6 +378,96 @@ double ToyFitterExclusion::eval_testStatMinuit( double mu )  {
 }
 
 
+double ToyFitterExclusion::quantileAt( double mu ) {
+
+    // for large value where the graph is not defined  no need to extrapolate
+    double last_mu = (graph_of_quantiles->GetX())[graph_of_quantiles->GetN() - 1];
+
+    return graph_of_quantiles->Eval( TMath::Min(mu, last_mu) );
+}
+
+
+double ToyFitterExclusion::eval_testStatDifference( double mu ) {
+
+    double qstat = computeTS(mu);
+    double delta = qstat - quantileAt(mu);
+
+    Debug("limitLoop", TString::Format("current_mu = %f   ;  current_qstat = %f  ;  delta = %f" ,mu, qstat, delta));
+
+    testStat_limit = qstat;
+
+    return delta;
+}
+
+
+double ToyFitterExclusion::findCrossing(double lo, double f_lo, double hi, double f_hi, double guess, double mu_max){
+
+    const int maxFits = 20;
+
+    limit_converged = false;
+
+    double start = lo;
+    double mu    = guess;
+    int    side  = 0;    // Illinois: the end point kept twice in a row gets its value halved
+
+    if(mu == UNDEFINED || mu <= lo || (hi != UNDEFINED && mu >= hi))
+        mu = (hi == UNDEFINED) ? lo + 1. : hi - f_hi * (hi - lo) / (f_hi - f_lo);
+    if(hi == UNDEFINED) mu = TMath::Min(mu, mu_max);
+
+    double prev_lo = UNDEFINED, prev_f_lo = 0.;
+
+    // the fit results (testStat_limit, cond_params...) are those of the last evaluated mu,
+    // which is therefore the one returned
+    double evaluated = mu;
+
+    for(int itr = 0; itr < maxFits; itr++) {
+
+        double f = eval_testStatDifference(mu);
+        evaluated = mu;
+
+        if(fabs(f) < 0.01) {
+            limit_converged = true;
+            return mu;
+        }
+
+        if(f * f_lo > 0.) {
+            prev_lo = lo; prev_f_lo = f_lo;
+            lo = mu; f_lo = f;
+            if(side == -1) f_hi /= 2.;
+            side = -1;
+        }
+        else {
+            hi = mu; f_hi = f;
+            if(side == 1) f_lo /= 2.;
+            side = 1;
+        }
+
+        if(hi == UNDEFINED) {
+            // not bracketed yet: secant on the last two points below, with some overshoot
+            if(lo >= mu_max) break;
+            double next = lo + (lo - start + 1.);
+            if(prev_lo != UNDEFINED && f_lo != prev_f_lo) {
+                double secant = lo - f_lo * (lo - prev_lo) / (f_lo - prev_f_lo);
+                if(secant > lo) next = TMath::Min(lo + 1.2 * (secant - lo), next + (lo - start + 1.));
+            }
+            mu = TMath::Min(next, mu_max);
+            continue;
+        }
+
+        if(fabs(hi - lo) < limitTolerance) {
+            limit_converged = true;
+            return evaluated;
+        }
+
+        mu = hi - f_hi * (hi - lo) / (f_hi - f_lo);
+    }
+
+    Warning("findCrossing", TString::Format("no crossing found within %d fits, returning mu = %f", maxFits, evaluated));
+
+    return evaluated;
+}
+
+
 double ToyFitterExclusion::getBestAsympoticGuessForMu(double one_over_sigma_squared, double mu_hat){
     
     // according to asymptotic formulae:
@@ -291,6 +522,7 @@ double ToyFitterExclusion::computeTS(double mu) {
     // perform conditional fit
     likeHood->getParameter(PAR_SIGMA)->setCurrentValue(mu);
     double LL_numerator = likeHood->maximize(true) ;
+    conditionalFits++;
     
     // saving the conditional likelihood for outTree
     likelihood_cond = LL_numerator;
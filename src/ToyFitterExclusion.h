@@ -2,6 +2,7 @@
 #define TOY_FITTER
 
 #include "XeLikelihoods.h"
+#include "ToyGenerator.h"
 #include "TGraphAsymmErrors.h"
 #include "TGraph.h"
 #include "XeUtils.h"
@@ -20,6 +21,7 @@
 #include "TH2F.h"
 #include <map>
 #include <vector>
+#include <algorithm>
 #include <stdio.h>
 #include "plotHelpers.h"
 
@@ -30,6 +32,10 @@
 
 using namespace std;
 
+enum limitFinderModes { LIMIT_FINDER_BRENT    // minimization of |quantile - q| with BrentMinimizer1D
+                      , LIMIT_FINDER_ROOT     // Illinois root finding of q - quantile, bracket from the asymptotic guess
+                      } ;
+
 /**
  * \class ToyFitterExclusion
  * \brief Class to handle the fitting of toy dataset for limit production.
@@ -71,6 +77,34 @@ class ToyFitterExclusion: public errorHandler {
      */
     void fit(double mu, int stopAt=-999);
 
+    /**
+     * \brief same as fit(double mu, int stopAt) for several mu at once.
+     *
+     * Each toy is loaded and fitted unconditionally once, then the conditional fits run
+     * in increasing mu, each warm started from the previous ones (WARM_START_NEAREST
+     * unless the likelihood has its own warm start mode). The output tree has one entry
+     * per toy and mu, with the same branches as fit(double mu, int stopAt).
+     * The NP measures are randomized once per toy and shared by all mu.
+     * @param mus: the signal strenghts of the conditional fits.
+     * @parma stopAt:  optional, the number of toy in file you want to fit.
+     */
+    void fit(const vector<double> &mus, int stopAt=-999);
+
+    /**
+     * \brief same as fit(const vector<double> &mus, int stopAt) on N toys generated on the fly, with no toy file.
+     *
+     * The generator draws the toys (with signal mu_true, see ToyGenerator::startPipeline) on its own
+     * thread while the previous ones are fitted, at most queueSize toys wait in memory.
+     * Calibration toys are generated too if the likelihood uses the safeguard. The generator
+     * likelihood can be the one being fitted, unless randomizeNP.
+     * @param generator: the toy generator, with its settings (seed, events, streams, archive).
+     * @param mu_true: the injected signal of the toys.
+     * @param mus: the signal strenghts of the conditional fits.
+     * @param N: number of toys.
+     */
+    void fitGenerated(ToyGenerator *generator, double mu_true, const vector<double> &mus, int N,
+                      bool randomizeNP = false, int queueSize = 8);
+
     //! \brief set the likelihood to fit
     void setTheLikelihood(ProfileLikelihood *like) { likeHood = like; };
 
@@ -133,13 +167,22 @@ class ToyFitterExclusion: public errorHandler {
 
     //! set the Generation, this info will be available in the generated tree (so that u can hadd them), it is optional and non ncecessary.
     void setGeneration(int generation) { Gen = generation; };
+
+    //! \brief set how spitTheLimit finds the crossing of the test statistic with the quantiles, default LIMIT_FINDER_BRENT.
+    //! The number of conditional fits of each limit goes in the "limit_fits" branch.
+    void setLimitFinder(int mode) { limitFinder = mode; };
+
+    //! \brief set the tolerance on mu of LIMIT_FINDER_ROOT, default 0.01.
+    void setLimitTolerance(double tolerance) { limitTolerance = tolerance; };
     
   private:
 
     //! \brief fancy method that loops over a list of tree in a file and run the p2method() function on each.
     //!
     //! @params stopAt: number of tree one wants to loop on
-    void for_each_tree( double (ToyFitterExclusion::*p2method)(double), TTree *outTree, double mu, int stopAt = -999);
+    //! p2method() is called for each of the mus, on the same tree, filling outTree each time.
+    //! If queue is not NULL the toys are taken from it until it is closed, instead of the trees.
+    void for_each_tree( double (ToyFitterExclusion::*p2method)(double), TTree *outTree, const vector<double> &mus, int stopAt = -999, toyQueue *queue = NULL);
 
     //! \brief compute the limit starting from initial_mu via a loop on computeTS
     //! and using graph_of_quantiles
@@ -157,6 +200,18 @@ class ToyFitterExclusion: public errorHandler {
     //! \brief function implementation to be used in limit minuit minimization
     double eval_testStatMinuit( double mu );
 
+    //! \brief signed difference between the test statistic and the quantile at mu
+    double eval_testStatDifference( double mu );
+
+    //! \brief 90% quantile of the alternative hypothesis, constant beyond the last mu of the graph
+    double quantileAt( double mu );
+
+    //! \brief Illinois root finding of eval_testStatDifference() starting from guess.
+    //!
+    //! The difference changes sign between lo and hi, hi = UNDEFINED if the crossing is not bracketed
+    //! yet: then it is searched above lo, up to mu_max. Sets limit_converged.
+    double findCrossing(double lo, double f_lo, double hi, double f_hi, double guess, double mu_max);
+
     //! \brief computes the best approximation using Wilks theorem to the mu @90%
     double getBestAsympoticGuessForMu(double one_over_sigma_squared, double mu_hat );
 
@@ -180,6 +235,10 @@ class ToyFitterExclusion: public errorHandler {
     double        uncond_params[50] = {0.};   //! unconditional fit
     double        cond_params[50] = {0.};     //! conditional fit
     bool          limit_converged;      //! if limit finder converged or not
+    int           limitFinder;          //! see limitFinderModes
+    double        limitTolerance;       //! tolerance on mu of LIMIT_FINDER_ROOT
+    int           limit_fits;           //! conditional fits used for the last limit
+    int           conditionalFits;      //! conditional fits done by computeTS
     double        testStat_limit;       //! value of test statistic at limit
     double        testStat_at0;         //! value of test statistic at mu =0.
     vector<string> name_params;         //! names of parameters
@@ -7,27 +7,73 @@ ToyGenerator::ToyGenerator(TString sampleName, TString outDir):errorHandler("Toy
     averageCalEvnt  = -9;
     averageDataEvnt = -9;
     likeHood = NULL;
-    int       Gen = UNDEFINED_INT;
-    int       likelihoodType = UNDEFINED_INT;
+    Gen = UNDEFINED_INT;
+    likelihoodType = UNDEFINED_INT;
+    seed = 0;
+    nToyThreads = 0;
+    firstToy = 0;
+    toyStore = false;
+    binnedToys = false;
+    archiveName = "";
 
 }
 
 
-void ToyGenerator::setSeed(int seed){
+ToyGenerator::~ToyGenerator(){
 
+    if(pipeline.joinable()) pipeline.join();
+}
+
+
+void ToyGenerator::setSeed(int s){
+
+    seed = s;
     rambo.SetSeed(seed);
 }
 
 
-void ToyGenerator::saveParameters(TTree *tree){
+UInt_t ToyGenerator::getToySeed(int toyItr){
+
+    // splitmix64 finalizer over the three integers, nearby toys get unrelated seeds
+    ULong64_t h = 0x9E3779B97F4A7C15ULL;
+    ULong64_t keys[3] = { (ULong64_t)(UInt_t) seed, (ULong64_t)(UInt_t) Gen, (ULong64_t)(UInt_t) toyItr };
+
+    for(int k=0; k < 3; k++){
+        h ^= keys[k] + 0x9E3779B97F4A7C15ULL + (h << 6) + (h >> 2);
+        h ^= h >> 30; h *= 0xBF58476D1CE4E5B9ULL;
+        h ^= h >> 27; h *= 0x94D049BB133111EBULL;
+        h ^= h >> 31;
+    }
+
+    // TRandom3 takes 32 bits, and 0 would mean a time based seed
+    UInt_t s = (UInt_t) (h ^ (h >> 32));
+    return (s == 0) ? 1 : s;
+}
+
+
+void ToyGenerator::buildSamplers(toySamplers &samplers){
+
+    vector <TH2F> backgrounds = getTH2OfBkg();
+
+    samplers.bkg.resize(backgrounds.size());
+    for(unsigned int bkgItr=0; bkgItr < backgrounds.size(); bkgItr++)
+        samplers.bkg[bkgItr].build(backgrounds[bkgItr]);
+
+    if(likeHood->signal_component != NULL)
+        samplers.signal.build(likeHood->signal_component->getInterpolatedHisto());
+
+    if(likeHood->safeguardAdditionalComponent != NULL)
+        samplers.additional.build(*likeHood->safeguardAdditionalComponent);
+}
+
+
+void ToyGenerator::saveParameters(TTree *tree, const vector<pair<TString,double> > &params){
 
     TList *config = tree->GetUserInfo();
 
-    map <int, LKParameter*> *params = likeHood->getParameters();
-    for(ParameterIterator ip=params->begin(); ip!=params->end(); ip++){
+    for(unsigned int i=0; i < params.size(); i++){
 
-        LKParameter *param = ip->second;
-        TParameter<double> *temp_p = new TParameter<double>(param->getName(), param->getCurrentValue());
+        TParameter<double> *temp_p = new TParameter<double>(params[i].first, params[i].second);
 
         config->Add(temp_p);
     }
@@ -53,181 +99,368 @@ void ToyGenerator::generateCalibration(int N, bool randomizeNP ){
 
     TFile f(filename, "RECREATE");
 
-    // necessary because TH2F::GetRandom uses ROOT::gRandom
-    gRandom = &rambo;
+    // rescaling to defined Calibration events
+    double default_evnt = getModelIntegralSafeguarded();
+    if(!(default_evnt> 0.)) Error("generateCalibration", "you MUST set Safeguarded components.");
+
+    Debug("generateCalibration: default_event =", TString::Itoa(default_evnt,10));
+
+    double scaleFactor  =  averageCalEvnt / default_evnt ;
+
+    Debug("generateCalibration: scaleFactor =", TString::Itoa(scaleFactor,10));
 
     // actual generation of N toys with poisson fluctuating events.
-    for(int toyItr =0; toyItr < N ; toyItr++){
+    generateToys(N, randomizeNP, true, scaleFactor);
 
+    f.Close();
 
-        // randomize initial 'true' values of NP
-        if(randomizeNP)  randomizeNuissanceParameter();
+}
 
-        // rescaling to defined Calibration events
-        double default_evnt = getModelIntegralSafeguarded();
-        if(!(default_evnt> 0.)) Error("generateCalibration", "you MUST set Safeguarded components.");
 
-        Debug("generateCalibration: default_event =", TString::Itoa(default_evnt,10));
+void ToyGenerator::generateData(double mu, int N, bool randomizeNP){
 
-        double scaleFactor  =  averageCalEvnt / default_evnt ;
+    // the idea is to generate N toys with the current seed
+    // Each dataset will contain as average averageDataEvnt events
+    // which will be Poisson random distributed.
+    TString filename =  dir+treeName+".root";
+    if (likelihoodType>-999){
+      filename = dir+treeName+"_vol"+TString::Itoa(likelihoodType,10)+".root";
+    }
 
-        Debug("generateCalibration: scaleFactor =", TString::Itoa(scaleFactor,10));
 
-        // retrive a vector of TH2F of interpolated bkg components
-        vector <TH2F> backgrounds = getTH2OfBkg();
+    TFile f(filename ,"RECREATE");
 
-        TString name = treeName + "_Cal_" + TString::Itoa(toyItr,10);
-        TTree toyTree (name, "generated toy Calibration");
-        float cs1 = 0.;
-        float cs2 = 0.;
-        string type = "DummyLabel";
+    // set the parameter of interest to the specified value
+    likeHood->getParameter(PAR_SIGMA)->setCurrentValue(mu);
 
-        toyTree.Branch("cs1",&cs1,"cs1/F");
-        toyTree.Branch("cs2",&cs2,"cs2/F");
-        toyTree.Branch("type",&type);
-        toyTree.Branch("generation",&Gen,"generation/I");
-        toyTree.Branch("likelihoodType",&likelihoodType,"likelihoodType/I");
-        toyTree.Branch("toyItr",&toyItr,"toyItr/I");
+    // rescaling to defined data events
+    double default_evnt = getModelIntegral();
+    double scaleFactor  = (averageDataEvnt>0.) ? averageDataEvnt / default_evnt : 1.;
 
-        saveParameters(&toyTree);
+    // actual generation of N toys with poisson fluctuating events.
+    generateToys(N, randomizeNP, false, scaleFactor);
 
-        // loop over each component extract N events and dice s1-s2
-        for(unsigned int bkgItr=0; bkgItr < backgrounds.size(); bkgItr++){
+    likeHood->printCurrentParameters();
 
-            // only safeguarded conponent
-            if(!(likeHood->safeguarded_bkg_components[bkgItr])) continue;
+    f.Close();
 
-            Debug("generateCalibration","");
+}
 
-            int N_events   = rambo.Poisson(scaleFactor * backgrounds[bkgItr].Integral());
-                    
-            type = (likeHood->bkg_components[bkgItr])->getComponentName();
 
-            Debug("generateCalibration", TString::Format("Generating %d events for %s, with median %f",N_events, (likeHood->bkg_components[bkgItr])->getComponentName().Data(), scaleFactor * backgrounds[bkgItr].Integral()));
-            for(int evt =0; evt < N_events; evt++){
+void ToyGenerator::generateToys(int N, bool randomizeNP, bool calibration, double scaleFactor){
 
-                double temp_cs1 = 0., temp_cs2 = 0.;
-                backgrounds[bkgItr].GetRandom2(temp_cs1,temp_cs2);
-                cs1 = (float) temp_cs1;// TODO FIXME this is just for back compatibility cs1 and cs2 must be double
-                cs2 = (float) temp_cs2;
-                toyTree.Fill();
-            }
+    // the templates change only if the NP are randomized
+    toySamplers nominal;
+    if(!randomizeNP) buildSamplers(nominal);
+
+    if(toyStore) store.open(calibration ? treeName + "_Cal" : treeName, calibration, likeHood, Gen, likelihoodType, binnedToys && !calibration);
+
+    // a single stream for all toys, toy k depends on the draws of the toys before
+    if(nToyThreads < 1) {
+        toyBuffer toy;
+        for(int toyItr = firstToy; toyItr < firstToy + N ; toyItr++){
+            prepareToy(toy, rambo, randomizeNP, calibration);
+            fillToy(toy, rambo, randomizeNP ? toy.samplers : nominal, scaleFactor, calibration);
+            writeToy(toy, toyItr, calibration, toyStore ? &store : NULL);
         }
+        if(toyStore) store.close();
+        return;
+    }
+
+    // one stream per toy, in batches: serial preparation, parallel draws, writing in toy order
+    workerPool pool(nToyThreads);
+    int batch = 4 * nToyThreads;
+    vector<toyBuffer> toys(batch);
+    vector<TRandom3>  streams(batch);
+
+    for(int start = 0; start < N; start += batch){
 
-        // adding the "additional component" events
-        int N_additional   =
-            (likeHood->safeguardAdditionalComponent !=NULL) ? rambo.Poisson(scaleFactor * likeHood->safeguardAdditionalComponent->Integral()) : 0;
-
-        type = "additional";
-        Debug("generateCalibration", TString::Format("Generating %d events for additional component",N_additional));
-        for(int evt =0; evt < N_additional; evt++){
-            double temp_cs1 = 0., temp_cs2 = 0.; // TODO FIXME this is just for back compatibility cs1 and cs2 must be double
-            likeHood->safeguardAdditionalComponent->GetRandom2(temp_cs1,temp_cs2);
-            cs1 = (float) temp_cs1;// TODO FIXME this is just for back compatibility cs1 and cs2 must be double
-            cs2 = (float) temp_cs2;
-            toyTree.Fill();
+        int n = TMath::Min(batch, N - start);
+
+        for(int i=0; i < n; i++){
+            streams[i].SetSeed(getToySeed(firstToy + start + i));
+            prepareToy(toys[i], streams[i], randomizeNP, calibration);
         }
 
-        toyTree.Write();
+        pool.run(n, [&](int i){
+            fillToy(toys[i], streams[i], randomizeNP ? toys[i].samplers : nominal, scaleFactor, calibration);
+        });
+
+        for(int i=0; i < n; i++) writeToy(toys[i], firstToy + start + i, calibration, toyStore ? &store : NULL);
     }
 
-    f.Close();
+    if(toyStore) store.close();
 
 }
 
 
-void ToyGenerator::generateData(double mu, int N, bool randomizeNP){
+void ToyGenerator::prepareToy(toyBuffer &toy, TRandom &rng, bool randomizeNP, bool calibration){
 
-    // the idea is to generate N toys with the current seed
-    // Each dataset will contain as average averageDataEvnt events
-    // which will be Poisson random distributed.
-    TString filename =  dir+treeName+".root";
-    if (likelihoodType>-999){
-      filename = dir+treeName+"_vol"+TString::Itoa(likelihoodType,10)+".root";
+    // randomize initial 'true' values of NP
+    if(randomizeNP) {
+        randomizeNuissanceParameter(rng);
+        buildSamplers(toy.samplers);
     }
 
+    toy.params.clear();
+    map <int, LKParameter*> *params = likeHood->getParameters();
+    for(ParameterIterator ip=params->begin(); ip!=params->end(); ip++)
+        toy.params.push_back(make_pair(ip->second->getName(), ip->second->getCurrentValue()));
 
-    TFile f(filename ,"RECREATE");
-    // necessary because TH2F::GetRandom uses ROOT::gRandom
-    gRandom = &rambo;
+    // filling signal if any
+    toy.signalEvents = (!calibration && likeHood->getParameter(PAR_SIGMA)->getCurrentValue() > 0) ? likeHood->getCurrentNs() : 0.;
+}
 
-    // actual generation of N toys with poisson fluctuating events.
-    for(int toyItr =0; toyItr < N ; toyItr++){
-
-        // randomize initial 'true' values of NP
-        if(randomizeNP) randomizeNuissanceParameter();
-        // set the parameter of interest to the specified value
-        likeHood->getParameter(PAR_SIGMA)->setCurrentValue(mu);
-
-        // rescaling to defined data events
-        double default_evnt = getModelIntegral();
-        double scaleFactor  = (averageDataEvnt>0.) ? averageDataEvnt / default_evnt : 1.;
-
-        // retrive a vector of TH2F of interpolated bkg components
-        vector <TH2F> backgrounds = getTH2OfBkg();
-
-        TString name = treeName + "_" + TString::Itoa(toyItr,10);
-        TTree toyTree (name, "generated toy data");
-        float cs1 = 0.;
-        float cs2 = 0.;
-        string type = "DummyLabel";
-
-        toyTree.Branch("cs1",&cs1,"cs1/F");
-        toyTree.Branch("cs2",&cs2,"cs2/F");
-        toyTree.Branch("type",&type);
-        toyTree.Branch("generation",&Gen,"generation/I");
-        toyTree.Branch("likelihoodType",&likelihoodType,"likelihoodType/I");
-        toyTree.Branch("toyItr",&toyItr,"toyItr/I");
-
-        saveParameters(&toyTree);
-
-
-        // loop over each bkg extract N events and dice s1-s2
-        for(unsigned int bkgItr=0; bkgItr < backgrounds.size(); bkgItr++){
-            int N_events   = rambo.Poisson(scaleFactor * backgrounds[bkgItr].Integral());
-        
-            type = (likeHood->bkg_components[bkgItr])->getComponentName();
-            
-            Debug("generateData", TString::Format("Generating %d events for %s, with median %f",N_events, (likeHood->bkg_components[bkgItr])->getComponentName().Data(), scaleFactor * backgrounds[bkgItr].Integral()));
-
-            for(int evt =0; evt < N_events; evt++){
-                double temp_cs1 = 0., temp_cs2 = 0.;
-                backgrounds[bkgItr].GetRandom2(temp_cs1,temp_cs2);
-                cs1 = (float) temp_cs1;// TODO FIXME this is just for back compatibility cs1 and cs2 must be double
-                cs2 = (float) temp_cs2;
-                toyTree.Fill();
+
+void ToyGenerator::fillToy(toyBuffer &toy, TRandom &rng, const toySamplers &samplers, double scaleFactor, bool calibration){
+
+    toy.cs1.clear();
+    toy.cs2.clear();
+    toy.component.clear();
+    toy.count.clear();
+
+    if(binnedToys && !calibration) {
+        fillBinnedToy(toy, rng, samplers, scaleFactor);
+        return;
+    }
+
+    // loop over each bkg extract N events and dice s1-s2
+    for(unsigned int bkgItr=0; bkgItr < samplers.bkg.size(); bkgItr++){
+
+        // only safeguarded conponent for calibration
+        if(calibration && !(likeHood->safeguarded_bkg_components[bkgItr])) continue;
+
+        int N_events   = rng.Poisson(scaleFactor * samplers.bkg[bkgItr].getIntegral());
+
+        XE_DEBUG("fillToy", TString::Format("Generating %d events for %s, with median %f",N_events, (likeHood->bkg_components[bkgItr])->getComponentName().Data(), scaleFactor * samplers.bkg[bkgItr].getIntegral()));
+
+        for(int evt =0; evt < N_events; evt++){
+            double temp_cs1 = 0., temp_cs2 = 0.;
+            samplers.bkg[bkgItr].draw(rng, temp_cs1, temp_cs2);
+            toy.cs1.push_back((float) temp_cs1);   // TODO FIXME this is just for back compatibility cs1 and cs2 must be double
+            toy.cs2.push_back((float) temp_cs2);
+            toy.component.push_back(bkgItr);
+        }
+    }
+
+    // adding the "additional component" events for calibration, the signal for data
+    int N_other = 0;
+    const templateSampler *other = NULL;
+    int otherComponent = 0;
+
+    if(calibration && likeHood->safeguardAdditionalComponent != NULL) {
+        N_other = rng.Poisson(scaleFactor * samplers.additional.getIntegral());
+        other = &samplers.additional;
+        otherComponent = ADDITIONAL_COMPONENT;
+    }
+    else if(!calibration && toy.signalEvents > 0.) {
+        N_other = rng.Poisson(toy.signalEvents);
+        other = &samplers.signal;
+        otherComponent = SIGNAL_COMPONENT;
+    }
+
+    XE_DEBUG("fillToy", TString::Format("Generating %d events for %s", N_other, calibration ? "additional component" : "signal"));
+
+    for(int evt =0; evt < N_other; evt++){
+        double temp_cs1 = 0., temp_cs2 = 0.;
+        other->draw(rng, temp_cs1, temp_cs2);
+        toy.cs1.push_back((float) temp_cs1);
+        toy.cs2.push_back((float) temp_cs2);
+        toy.component.push_back(otherComponent);
+    }
+}
+
+
+void ToyGenerator::startPipeline(toyQueue &queue, double mu, int N, bool randomizeNP, bool withCalibration){
+
+    if(pipeline.joinable()) Error("startPipeline", "a pipeline is already running, call joinPipeline().");
+
+    // set the parameter of interest to the specified value
+    likeHood->getParameter(PAR_SIGMA)->setCurrentValue(mu);
+
+    // rescaling to defined data events
+    double dataScale = (averageDataEvnt>0.) ? averageDataEvnt / getModelIntegral() : 1.;
+
+    // rescaling to defined Calibration events
+    double calScale  = 0.;
+    if(withCalibration) {
+        if(!(averageCalEvnt>0)) Error("startPipeline", "you MUST set averageCalEvnt.");
+        double default_evnt = getModelIntegralSafeguarded();
+        if(!(default_evnt> 0.)) Error("startPipeline", "you MUST set Safeguarded components.");
+        calScale = averageCalEvnt / default_evnt;
+    }
+
+    // with fixed NP everything that needs the likelihood is done here, the thread only draws
+    if(!randomizeNP) {
+        buildSamplers(pipelineSamplers);
+        prepareToy(pipelineNominal, rambo, false, false);
+    }
+
+    // histograms and files are made on the generation thread too
+    ROOT::EnableThreadSafety();
+
+    pipelineFailure = nullptr;
+    pipeline = thread(&ToyGenerator::runPipeline, this, &queue, N, randomizeNP, withCalibration, dataScale, calScale);
+}
+
+
+void ToyGenerator::joinPipeline(){
+
+    if(pipeline.joinable()) pipeline.join();
+
+    if(pipelineFailure) {
+        std::exception_ptr failure = pipelineFailure;
+        pipelineFailure = nullptr;
+        std::rethrow_exception(failure);
+    }
+}
+
+
+void ToyGenerator::runPipeline(toyQueue *queue, int N, bool randomizeNP, bool withCalibration, double dataScale, double calScale){
+
+    TFile *archive = NULL;
+    toyStoreWriter archiveData, archiveCalibration;
+
+    try {
+        if(archiveName != "") {
+            archive = new TFile(archiveName, "RECREATE");
+            if(toyStore) {
+                archiveData.open(treeName, false, likeHood, Gen, likelihoodType, binnedToys);
+                if(withCalibration) archiveCalibration.open(treeName + "_Cal", true, likeHood, Gen, likelihoodType, false);
             }
         }
 
-        if(mu > 0) {
-          // filling signal if any
-          type = likeHood->signal_component->getComponentName();
-          int N_signal  = rambo.Poisson(likeHood->getCurrentNs());
-          TH2F signal   = likeHood->signal_component->getInterpolatedHisto();
+        TRandom3 stream;
 
-          Debug("generateData", TString::Format("Generating %d events for signal, with median %f",N_signal, likeHood->getCurrentNs() ));
+        for(int toyItr = firstToy; toyItr < firstToy + N ; toyItr++){
 
-          for(int evt =0; evt < N_signal; evt++){
-            double temp_cs1 = 0., temp_cs2 = 0.;
-            signal.GetRandom2(temp_cs1,temp_cs2);
-            cs1 = (float) temp_cs1;// TODO FIXME this is just for back compatibility cs1 and cs2 must be double
-            cs2 = (float) temp_cs2;
-            toyTree.Fill();
-          }
+            TRandom *rng = &rambo;
+            if(nToyThreads >= 1) {
+                stream.SetSeed(getToySeed(toyItr));
+                rng = &stream;
+            }
+
+            generatedToy *toy = new generatedToy;
+            toy->toyItr = toyItr;
+            toy->withCalibration = withCalibration;
+
+            if(randomizeNP) prepareToy(toy->data, *rng, true, false);
+            else {
+                toy->data.params       = pipelineNominal.params;
+                toy->data.signalEvents = pipelineNominal.signalEvents;
+            }
+
+            const toySamplers &samplers = randomizeNP ? toy->data.samplers : pipelineSamplers;
+            fillToy(toy->data, *rng, samplers, dataScale, false);
+
+            if(withCalibration) {
+                toy->calibration.params = toy->data.params;
+                fillToy(toy->calibration, *rng, samplers, calScale, true);
+            }
+
+            if(archive != NULL) {
+                writeToy(toy->data, toyItr, false, toyStore ? &archiveData : NULL);
+                if(withCalibration) writeToy(toy->calibration, toyItr, true, toyStore ? &archiveCalibration : NULL);
+            }
+
+            // the templates are not needed by the fit
+            toy->data.samplers = toySamplers();
 
+            // closed by the reader: nobody wants more toys
+            if(!queue->push(toy)) { delete toy; break; }
         }
+    }
+    catch(...) {
+        pipelineFailure = std::current_exception();
+    }
+
+    if(archive != NULL) {
+        if(archiveData.isOpen())        archiveData.close();
+        if(archiveCalibration.isOpen()) archiveCalibration.close();
+        archive->Close();
+        delete archive;
+    }
+
+    queue->close();
+}
+
+
+void ToyGenerator::fillBinnedToy(toyBuffer &toy, TRandom &rng, const toySamplers &samplers, double scaleFactor){
 
-        toyTree.Write();
+    // all templates share the binning, the expected events of each bin are summed over the components
+    unsigned int nbins = samplers.bkg.empty() ? samplers.signal.getNbins() : samplers.bkg[0].getNbins();
+    vector<double> expected(nbins, 0.);
 
+    for(unsigned int bkgItr=0; bkgItr < samplers.bkg.size(); bkgItr++){
+        if(samplers.bkg[bkgItr].getNbins() != nbins) Error("fillBinnedToy", "binned toys need templates with the same binning.");
+        samplers.bkg[bkgItr].addContent(expected, scaleFactor);
     }
+    if(samplers.signal.isBuilt() && samplers.signal.getNbins() != nbins) Error("fillBinnedToy", "binned toys need templates with the same binning.");
 
-    likeHood->printCurrentParameters();
+    if(toy.signalEvents > 0. && samplers.signal.getIntegral() > 0.)
+        samplers.signal.addContent(expected, toy.signalEvents / samplers.signal.getIntegral());
 
-    f.Close();
+    // a sum of Poisson is a Poisson of the sum: one draw per bin
+    for(unsigned int k=0; k < nbins; k++){
+        if(!(expected[k] > 0.)) continue;
+
+        int n = rng.Poisson(expected[k]);
+        if(n == 0) continue;
+
+        double x = 0., y = 0.;
+        samplers.bkg.empty() ? samplers.signal.getBinCentre(k, x, y) : samplers.bkg[0].getBinCentre(k, x, y);
+        toy.cs1.push_back((float) x);
+        toy.cs2.push_back((float) y);
+        toy.component.push_back(BINNED_COMPONENT);
+        toy.count.push_back(n);
+    }
+
+    XE_DEBUG("fillBinnedToy", TString::Format("Generated %u non empty bins", (unsigned int) toy.count.size()));
+}
+
+
+void ToyGenerator::writeToy(toyBuffer &toy, int toyItr, bool calibration, toyStoreWriter *store){
+
+    if(store != NULL) {
+        store->fill(toy, toyItr);
+        return;
+    }
+
+    TString name = calibration ? treeName + "_Cal_" + TString::Itoa(toyItr,10) : treeName + "_" + TString::Itoa(toyItr,10);
+    TTree toyTree (name, calibration ? "generated toy Calibration" : "generated toy data");
+    float cs1 = 0.;
+    float cs2 = 0.;
+    int   count = 1;
+    string type = "DummyLabel";
+
+    toyTree.Branch("cs1",&cs1,"cs1/F");
+    toyTree.Branch("cs2",&cs2,"cs2/F");
+    if(!toy.count.empty()) toyTree.Branch("count",&count,"count/I");
+    toyTree.Branch("type",&type);
+    toyTree.Branch("generation",&Gen,"generation/I");
+    toyTree.Branch("likelihoodType",&likelihoodType,"likelihoodType/I");
+    toyTree.Branch("toyItr",&toyItr,"toyItr/I");
+
+    saveParameters(&toyTree, toy.params);
+
+    for(unsigned int evt=0; evt < toy.cs1.size(); evt++){
+        int c = toy.component[evt];
+        if(c == SIGNAL_COMPONENT)          type = likeHood->signal_component->getComponentName();
+        else if(c == ADDITIONAL_COMPONENT) type = "additional";
+        else if(c == BINNED_COMPONENT)     type = "binned";
+        else                               type = (likeHood->bkg_components[c])->getComponentName();
+
+        cs1 = toy.cs1[evt];
+        cs2 = toy.cs2[evt];
+        if(!toy.count.empty()) count = toy.count[evt];
+        toyTree.Fill();
+    }
 
+    toyTree.Write();
 }
 
-void ToyGenerator::randomizeNuissanceParameter(){
+
+void ToyGenerator::randomizeNuissanceParameter(TRandom &rng){
     map <int, LKParameter*> *params = likeHood->getParameters();
 
     Info("randomizeNuissanceParameter", "Randomizing parameters:");
@@ -245,14 +478,14 @@ void ToyGenerator::randomizeNuissanceParameter(){
         double random_tvalue = 0.;
        /* if(param->getType() == FREE_PARAMETER ){
             Warning("","Following parameter is FREE and will be extracted from uniform distro. " + param->getName());
-            random_tvalue = rambo.Uniform(min,max);
+            random_tvalue = rng.Uniform(min,max);
         }
         else{
             */
-            random_tvalue = rambo.Gaus(0.,1.);
+            random_tvalue = rng.Gaus(0.,1.);
             // extract again if out of range
             while(random_tvalue > max || random_tvalue < min)
-                random_tvalue = rambo.Gaus(0.,1.);
+                random_tvalue = rng.Gaus(0.,1.);
         //}
 
         param->setCurrentValue(random_tvalue);
@@ -320,3 +553,81 @@ vector<TH2F> ToyGenerator::getTH2OfBkg(){
     return temp_v;
 
 }
+
+
+
+toyStoreWriter::toyStoreWriter(){
+
+    events = NULL;
+    index  = NULL;
+    binned = false;
+    generation = UNDEFINED_INT;
+    likelihoodType = UNDEFINED_INT;
+    nParams = 0;
+}
+
+
+void toyStoreWriter::open(TString prefix, bool calibration, pdfLikelihood *like, int gen, int lkType, bool isBinned){
+
+    generation     = gen;
+    likelihoodType = lkType;
+    binned         = isBinned;
+    count          = 1;
+
+    events = new TTree(prefix, calibration ? "generated toys Calibration" : "generated toys data");
+    events->Branch("cs1",&cs1,"cs1/F");
+    events->Branch("cs2",&cs2,"cs2/F");
+    events->Branch("toyItr",&toy,"toyItr/I");
+    events->Branch("component",&component,"component/I");
+    if(binned) events->Branch("count",&count,"count/I");
+
+    for(unsigned int bkgItr=0; bkgItr < like->bkg_components.size(); bkgItr++)
+        events->GetUserInfo()->Add(new TObjString((like->bkg_components[bkgItr])->getComponentName()));
+
+    nParams = like->getParameters()->size();
+    params.assign(TMath::Max(nParams, 1), 0.);
+
+    index = new TTree(prefix + "_index", "event range and true parameters of each toy");
+    index->Branch("toyItr",&toy,"toyItr/I");
+    index->Branch("first",&first,"first/L");
+    index->Branch("entries",&entries,"entries/L");
+    index->Branch("generation",&generation,"generation/I");
+    index->Branch("likelihoodType",&likelihoodType,"likelihoodType/I");
+    index->Branch("n_params",&nParams,"n_params/I");
+    index->Branch("true_params",&params[0],"true_params[n_params]/D");
+
+    map <int, LKParameter*> *parameters = like->getParameters();
+    for(ParameterIterator ip=parameters->begin(); ip!=parameters->end(); ip++)
+        index->GetUserInfo()->Add(new TObjString(ip->second->getName()));
+}
+
+
+void toyStoreWriter::fill(const toyBuffer &toyData, int toyItr){
+
+    toy     = toyItr;
+    first   = events->GetEntries();
+    entries = toyData.cs1.size();
+
+    for(unsigned int evt=0; evt < toyData.cs1.size(); evt++){
+        cs1       = toyData.cs1[evt];
+        cs2       = toyData.cs2[evt];
+        component = toyData.component[evt];
+        if(binned) count = toyData.count.empty() ? 1 : toyData.count[evt];
+        events->Fill();
+    }
+
+    for(unsigned int i=0; i < toyData.params.size() && i < params.size(); i++) params[i] = toyData.params[i].second;
+    index->Fill();
+}
+
+
+void toyStoreWriter::close(){
+
+    events->Write();
+    index->Write();
+
+    delete events;
+    delete index;
+    events = NULL;
+    index  = NULL;
+}
@@ -11,9 +11,11 @@
 #include "XeUtils.h"
 #include "XeLikelihoods.h"
 #include "TParameter.h"
+#include "TObjString.h"
 #include "XeStat.h"
 #include "TTree.h"
 #include "TH2F.h"
+#include "TROOT.h"
 #include <map>
 #include <vector>
 #include <stdio.h>
@@ -21,6 +23,76 @@
 using namespace std;
 
 
+//! \brief component of a generated event that is not a bkg (bkg events carry their index).
+enum toyComponents { SIGNAL_COMPONENT = -1, ADDITIONAL_COMPONENT = -2, BINNED_COMPONENT = -3 /*!< all components, binned toys */ };
+
+//! \brief samplers of the interpolated templates used to generate a toy.
+struct toySamplers {
+    vector<templateSampler> bkg;        //! one per bkg component, same order as the likelihood
+    templateSampler         signal;
+    templateSampler         additional; //! for the additional safeguard component
+};
+
+//! \brief one toy before it is written: its events and the true values of the parameters.
+struct toyBuffer {
+    vector<float>   cs1;
+    vector<float>   cs2;
+    vector<int>     component;          //! bkg index, or see toyComponents
+    vector<int>     count;              //! events at each entry (a bin centre) of a binned toy, empty if unbinned
+    vector<pair<TString,double> > params;
+    double          signalEvents;       //! expected signal events, 0 for no signal
+    toySamplers     samplers;           //! own templates, when the NP are randomized per toy
+};
+
+//! \brief a toy handed by ToyGenerator::startPipeline() to the fit, the calibration toy is drawn with the same NP.
+struct generatedToy {
+    int             toyItr;
+    toyBuffer       data;
+    toyBuffer       calibration;
+    bool            withCalibration;
+};
+
+typedef boundedQueue<generatedToy*> toyQueue;
+
+
+/**
+ * \class toyStoreWriter
+ * \brief writes toys into the two trees of a toy store, see ToyGenerator::setToyStore().
+ */
+class toyStoreWriter {
+
+    public:
+        toyStoreWriter();
+
+        //! \brief creates the trees prefix and prefix_index in the current directory, with a count column if binned.
+        void open(TString prefix, bool calibration, pdfLikelihood *like, int generation, int likelihoodType, bool binned);
+
+        //! \brief appends the events of toy, and its entry in the index.
+        void fill(const toyBuffer &toy, int toyItr);
+
+        //! \brief writes and deletes the trees.
+        void close();
+
+        bool isOpen() { return events != NULL; };
+
+    private:
+        TTree          *events;
+        TTree          *index;
+        float           cs1;
+        float           cs2;
+        int             toy;
+        int             component;
+        int             count;
+        bool            binned;
+        Long64_t        first;
+        Long64_t        entries;
+        int             generation;
+        int             likelihoodType;
+        int             nParams;
+        vector<double>  params;         //! sized once in open(), its buffer is the branch address
+};
+
+
 /**
  * \class ToyGenerator 
  * \brief Helper class to generate toys given an input likelihood. 
@@ -33,9 +105,13 @@ class ToyGenerator: public errorHandler {
         //! @param outDir: path to dir where you want to save toys
         ToyGenerator(TString sampleName, TString outDir);
 
+        ~ToyGenerator();
+
         //! \brief pointer to the defined likelihood
         void setLikelihood(pdfLikelihood *like) {likeHood = like;};
 
+        pdfLikelihood* getLikelihood() { return likeHood; };
+
         //! \brief the total number of events to which the calibtration pdfs will be rescaled.
         //
         //! The fraction of events given to each pdf component is defined in the likelihood. 
@@ -63,8 +139,56 @@ class ToyGenerator: public errorHandler {
         //! \brief generate N toys of the 'science data' dataset with injected signal fraction 'mu'.
         void generateData(double mu, int N, bool randomizeNP = false);
 
+        //! \brief generate N toys like generateData() on a separate thread, handing them to queue instead of a file.
+        //
+        //! The queue is closed after the last toy, or as soon as it is closed by the reader.
+        //! withCalibration adds a calibration toy (see generateCalibration()) drawn with the same NP.
+        //! The per toy streams of setParallelToys() are used if set, so the toys are the same as
+        //! the ones written by generateData(). The likelihood is only read by the generation thread,
+        //! unless randomizeNP: then it MUST NOT be the likelihood fitting the toys.
+        //! Call joinPipeline() when the reader is done.
+        void startPipeline(toyQueue &queue, double mu, int N, bool randomizeNP = false, bool withCalibration = false);
+
+        //! \brief waits for the generation thread of startPipeline(), rethrows its error if any.
+        void joinPipeline();
+
+        //! \brief file where the generation thread of startPipeline() archives the toys, in the
+        //! format of setToyStore(). Default "", no archive.
+        void setPipelineArchive(TString fileName) { archiveName = fileName; };
+
         //! set the seed for the toy generation. YOU MUST CHANGE THIS for any run.
         void setSeed(int seed);
+
+        //! \brief generate each toy from its own random stream, on nThreads threads.
+        //
+        //! The stream of a toy depends only on (seed, generation, toy index), so the output
+        //! is the same for any nThreads and a single toy can be regenerated alone with
+        //! setFirstToy(). The NP randomization and the templates are done serially, toy by toy,
+        //! then the events are drawn in parallel and the trees written in toy order.
+        //! nThreads = 0 (default) is the single stream of setSeed() for all toys.
+        void setParallelToys(int nThreads) { nToyThreads = nThreads; };
+
+        //! \brief index of the first generated toy, default 0: toys are firstToy ... firstToy + N - 1.
+        void setFirstToy(int first) { firstToy = first; };
+
+        //! \brief write all the toys of a file in a single store instead of one tree per toy, default false.
+        //
+        //! The store is two trees, named after the tree prefix ("treeName" or "treeName_Cal"):
+        //! - prefix: the events of all toys, with cs1, cs2, toyItr and component (bkg index, or
+        //!   see toyComponents). The bkg component names are in its UserInfo.
+        //! - prefix_index: one entry per toy with toyItr, first and entries (its event range),
+        //!   generation, likelihoodType and true_params[n_params]. The parameter names are in its UserInfo.
+        //! dataHandler::setTreeIndex() reads either format.
+        void setToyStore(bool b) { toyStore = b; };
+
+        //! \brief generate binned 'science data' toys, default false.
+        //
+        //! The events of all components are drawn as a Poisson count in each template bin, and only
+        //! the non empty bins are kept: an entry is the bin centre (cs1, cs2) with the "count" of
+        //! events, and dataHandler takes it as one point of weight count. This is exact for the
+        //! unbinned likelihood, where all the events of a bin see the same template value.
+        //! Calibration toys stay unbinned: the safeguard term does not take weights as counts.
+        void setBinnedToys(bool b) { binnedToys = b; };
         
         //! set the Generation, this info will be available in the generated tree (so that u can hadd them), it is optional and non ncecessary.
         void setGeneration(int generation) { Gen = generation; };
@@ -76,7 +200,7 @@ class ToyGenerator: public errorHandler {
         //
         //! The generated toys will not be generated now from nominal distro. YOU MUST change seed
         //! for each repetition of this.
-        void randomizeNuissanceParameter();
+        void randomizeNuissanceParameter() { randomizeNuissanceParameter(rambo); };
 
         //! \brief sets a new tree name prefix
         void setTreeName(TString newname) { treeName = newname;};
@@ -84,8 +208,38 @@ class ToyGenerator: public errorHandler {
 
     private:
         
-        //! \biref saves the current values of NP to the UserInfo TList of the Tree
-        void saveParameters(TTree *f);
+        //! \biref saves the values of NP to the UserInfo TList of the Tree
+        void saveParameters(TTree *f, const vector<pair<TString,double> > &params);
+
+        //! \brief same as randomizeNuissanceParameter() drawing from rng.
+        void randomizeNuissanceParameter(TRandom &rng);
+
+        //! \brief builds the samplers of the current interpolated templates, bkg and signal.
+        //!
+        //! With fixed nuisance parameters the templates do not change from toy to toy,
+        //! so this is called once per sample rather than once per toy.
+        void buildSamplers(toySamplers &samplers);
+
+        //! \brief generates the toys of generateCalibration() or generateData() into the current file.
+        void generateToys(int N, bool randomizeNP, bool calibration, double scaleFactor);
+
+        //! \brief serial part of a toy: randomizes the NP with rng if asked, keeps the parameter values.
+        void prepareToy(toyBuffer &toy, TRandom &rng, bool randomizeNP, bool calibration);
+
+        //! \brief draws the events of a toy with rng, the likelihood is only read: safe to run for several toys at once.
+        void fillToy(toyBuffer &toy, TRandom &rng, const toySamplers &samplers, double scaleFactor, bool calibration);
+
+        //! \brief draws a binned 'science data' toy, see setBinnedToys().
+        void fillBinnedToy(toyBuffer &toy, TRandom &rng, const toySamplers &samplers, double scaleFactor);
+
+        //! \brief writes a toy as a tree in the current directory, or appends it to store if not NULL.
+        void writeToy(toyBuffer &toy, int toyItr, bool calibration, toyStoreWriter *store);
+
+        //! \brief loop of the generation thread of startPipeline().
+        void runPipeline(toyQueue *queue, int N, bool randomizeNP, bool withCalibration, double dataScale, double calScale);
+
+        //! \brief seed of the random stream of a toy, a hash of (seed, generation, toy index).
+        UInt_t getToySeed(int toyItr);
         
         //! \brief return the sum of default integral of all bkg components.
         //! 
@@ -108,6 +262,20 @@ class ToyGenerator: public errorHandler {
         int       Gen;
         int       likelihoodType;
         TRandom3  rambo;
+        int       seed;
+        int       nToyThreads;      //! 0 for a single stream, otherwise threads of the per toy streams
+        int       firstToy;
+        bool      toyStore;
+        bool      binnedToys;
+        toyStoreWriter store;
+
+        //------ pipeline, see startPipeline() ------//
+        thread             pipeline;
+        std::exception_ptr pipelineFailure;
+        TString            archiveName;
+        toySamplers        pipelineSamplers;   //! templates, if the NP are not randomized
+        toyBuffer          pipelineNominal;    //! parameters, if the NP are not randomized
+        //-------------------------------------------//
         TString   treeName;
         TString   dir;
         pdfLikelihood *likeHood;
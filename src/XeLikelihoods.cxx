@@ -6,6 +6,8 @@ pdfLikelihood::~pdfLikelihood(){
 	safeguarded_bkg_components.clear();
 //	delete data;
 	delete asimovData;
+	delete templateBinning;
+	delete eventPool;
 //	delete dmData;
 
 }
@@ -37,6 +39,22 @@ pdfLikelihood::pdfLikelihood(TString nam, double wimpMass) : ProfileLikelihood(n
 
 	safeGuardPosDef = true;
 
+	binnedOccupancy = false;
+
+	withDensityMatrix = false;
+
+	nThreads = 1;
+
+	eventPool = NULL;
+
+	templateBinning = NULL;
+
+	signalIntegral    = 0.;
+
+	bkgIntegral       = 0.;
+
+	safeguardIntegral = 0.;
+
 	safeGuardParam    = NULL;
 
 	safeguardAdditionalComponent  = NULL;
@@ -259,7 +277,7 @@ double pdfLikelihood::getSafeguardValue(){
 
 double pdfLikelihood::computeTheLogLikelihood() {
 
-   Debug("pdfLikelihood::computeTheLogLikelihood"," ENTER");
+   XE_DEBUG("pdfLikelihood::computeTheLogLikelihood"," ENTER");
   //Retriving Parameter of Interest value
     double sigma = getPOI()->getCurrentValue();
 
@@ -267,7 +285,13 @@ double pdfLikelihood::computeTheLogLikelihood() {
   //Check fit  status: check all parameters value, if any is NaN means the
   //fit is bad. It can happen in case of crazy value of mu, not necessarily
   //means that the limit is bad.
-    TRAVERSE_PARAMETERS(it) {
+    if(block.isValid()) {
+	if(block.hasNaN()){
+		cout<<"pdfLikelihood::computeTheLogLikelihood - WARNING : Fit is unstable"<<endl;
+		return VERY_SMALL;
+	}
+    }
+    else TRAVERSE_PARAMETERS(it) {
 	double param_value = (it->second)->getCurrentValue();
      	if(std::isnan(param_value)){
     		cout<<"pdfLikelihood::computeTheLogLikelihood - WARNING : Fit is unstable"<<endl;
@@ -280,51 +304,17 @@ double pdfLikelihood::computeTheLogLikelihood() {
      double LL = 0;
 
    //------------- LOAD PDF WITH SYS VARIATION ---------------------//
-     TH2F signalPdf(signal_component->getInterpolatedHisto());
-
-     // get copy of bkg and sum over all, assumes they are normalized.
-     TH2F bkgPdf;
-
-
-     if(withSafeGuard)  {
-	     bkgPdf = getSafeguardedBkgPdf() ;
-
-             // MOSHE check here the safeguard implementation
-	     TH2F bkgPdftemp;
-             bkgPdftemp = (bkg_components[0]->getInterpolatedHisto());
-
-     	     for(unsigned int k=1; k < bkg_components.size(); k++){
-
-       		TH2F temp_bkgPdf (bkg_components[k]->getInterpolatedHisto());
-       		bkgPdftemp.Add(&temp_bkgPdf);
-     	    }
-
-            if (fabs(bkgPdf.Integral()-bkgPdftemp.Integral())>1e-2) {
-		    Error("ComputeTheLikelihood", Form("OOOHHHHHHHHHHHH background integral : %f %f \n",bkgPdf.Integral(), bkgPdftemp.Integral()));
-		}
-     }
-     else{
-		  Debug("computeTheLikelihood","Adding bkgs:");
-	  	  //just sum up components otherwise
-          bkgPdf = (bkg_components[0]->getInterpolatedHisto());
-		  Debug("computeTheLikelihood", TString::Format("\t%s  = %f events",bkgPdf.GetName(), bkgPdf.Integral()));
-
-          for(unsigned int k=1; k < bkg_components.size(); k++){
-
-	            TH2F temp_bkgPdf (bkg_components[k]->getInterpolatedHisto());
-		    	bkgPdf.Add(&temp_bkgPdf);
-				Debug("computeTheLikelihood", TString::Format("\t%s  = %f events", temp_bkgPdf.GetName(), temp_bkgPdf.Integral()));
-
-	    }
-	}
+     // the workspace buffers hold the interpolated templates, no histogram is built here.
+     if(withDensityMatrix) fillDensityWorkspace();
+     else                  fillTemplateWorkspace();
    //---------------------------------------------------------------//
 
 
 
 
    //----------------------- POISSON TERM --------------------------//
-     double Nb = bkgPdf.Integral();
-     double   Ns    = sigma * getSignalMultiplier() *  signalPdf.Integral();
+     double   Nb    = bkgIntegral;
+     double   Ns    = sigma * getSignalMultiplier() *  signalIntegral;
      double   Nobs  = data->getSumOfWeights();    // this is == Nentry in case of data, but is not in case of asimov
 
      //protection against uphysical values of Ns, this is very common in binned case
@@ -337,9 +327,9 @@ double pdfLikelihood::computeTheLogLikelihood() {
      LL += Nobs * log(Ns + Nb ) -Ns - Nb ;
    //---------------------------------------------------------------//
 
-    Debug("pdfLikelihood::computeTheLogLikelihood" , Form(" Ns %f    Nobs %f   Nb %f ", Ns , Nobs,  Nb));
-    Debug("pdfLikelihood::computeTheLogLikelihood" , Form(" Sigma %f    sigmaMultiplier %f  SignalHistoIntegral %f", sigma, getSignalMultiplier() , signalPdf.Integral() ));
-    Debug("pdfLikelihood::computeTheLogLikelihood" , Form(" PoissonTerm %f ",Nobs * log(Ns + Nb ) -Ns - Nb ));
+    XE_DEBUG("pdfLikelihood::computeTheLogLikelihood" , Form(" Ns %f    Nobs %f   Nb %f ", Ns , Nobs,  Nb));
+    XE_DEBUG("pdfLikelihood::computeTheLogLikelihood" , Form(" Sigma %f    sigmaMultiplier %f  SignalHistoIntegral %f", sigma, getSignalMultiplier() , signalIntegral ));
+    XE_DEBUG("pdfLikelihood::computeTheLogLikelihood" , Form(" PoissonTerm %f ",Nobs * log(Ns + Nb ) -Ns - Nb ));
 
 
 
@@ -348,39 +338,84 @@ double pdfLikelihood::computeTheLogLikelihood() {
 
     Long64_t Nentry  = data->getEntries();
 
-    Debug("pdfLikelihood::computeTheLogLikelihood" , Form(" Nentry %lld ", Nentry ));
-    //loop over all data
-    for(Long64_t event = 0; event < Nentry; event++){
-		double ts1=data->getS1(event);
-		double ts2=data->getS2(event);
-		double tweight=data->getW(event);
-	     //loads data TNtuple entry
-	     //data->getEntry(event);
-
-	     //double extended_signal =  data->getValFromPdf(signalPdf) * sigma * getSignalMultiplier();
-     	     //double extended_bkg    =  data->getValFromPdf( bkgPdf ) ;
-		//	     double extended_signal =  signalPdf.GetBinContent(signalPdf.GetXaxis()->FindBin(ts1), signalPdf.GetYaxis()->FindBin(ts2)) * sigma * getSignalMultiplier();
-		//    double extended_bkg    =   bkgPdf.GetBinContent(bkgPdf.GetXaxis()->FindBin(ts1), bkgPdf.GetYaxis()->FindBin(ts2));
-		double extended_signal =  signalPdf.GetBinContent(signalPdf.FindBin(ts1,ts2)) * sigma * getSignalMultiplier();
-		double extended_bkg    =   bkgPdf.GetBinContent(bkgPdf.FindBin(ts1,ts2));
-
-	    Debug("computeTheLogLikelihood", TString::Format("S1 %f  --- S2 %f  ---- weight %f  ---- Fs %f  ----- Fb %f", ts1, ts2, tweight,extended_signal, extended_bkg ));
-
-	    // check physical result
-	    if(extended_signal + extended_bkg < 0) {
-	      	Warning("pdfLikelihood::computeTheLogLikelihood" , "NsFs + NbFb < 0 ");
-	     	return VERY_SMALL;
-	    }
-		else if( extended_signal + extended_bkg > 0 )  // skipping the case of zero that ahime happens even tough my reccomendations on templates.
-	    	extended_term += tweight * log( (extended_signal + extended_bkg) / (Ns + Nb) ) ; //data weight is 1 for DM data and whatever for asimov
+    XE_DEBUG("pdfLikelihood::computeTheLogLikelihood" , Form(" Nentry %lld ", Nentry ));
 
-		Debug("computeTheLogLikelihood", TString::Format("Extended term  %f", extended_term ));
+    double signal_scale = sigma * getSignalMultiplier();
+    double total        = Ns + Nb;
+    bool   physical     = true;
 
+    if(withDensityMatrix) {
+	    // the points are events or occupied bins, depending on binnedOccupancy
+	    physical = parallelSum::run(dataMatrix.getNpoints(), eventPool,
+	        [&](Long64_t begin, Long64_t end, kahanSum &sum){
+		    for(Long64_t p = begin; p < end; p++){
+
+			double extended_signal =  signalDensity[p] * signal_scale;
+			double extended_bkg    =  bkgDensity[p];
+
+		    XE_DEBUG("computeTheLogLikelihood", TString::Format("bin %d  ---- weight %f  ---- Fs %f  ----- Fb %f", dataMatrix.bins[p], dataMatrix.weights[p], extended_signal, extended_bkg ));
+
+		    if(extended_signal + extended_bkg < 0) return false;
+			else if( extended_signal + extended_bkg > 0 )
+		    	sum.add( dataMatrix.weights[p] * log( (extended_signal + extended_bkg) / total ) );
+		    }
+		    return true;
+	        }, extended_term);
+    }
+    else if(binnedOccupancy) {
+	    // all events of a bin see the same template value: sum over occupied bins weighted by their content
+	    const vector<occupiedBin> &occupied = data->getOccupiedBins(templateBinning);
+
+	    physical = parallelSum::run(occupied.size(), eventPool,
+	        [&](Long64_t begin, Long64_t end, kahanSum &sum){
+		    for(Long64_t b = begin; b < end; b++){
+
+			double extended_signal =  signalContent[occupied[b].bin] * signal_scale;
+			double extended_bkg    =  bkgContent[occupied[b].bin];
+
+		    XE_DEBUG("computeTheLogLikelihood", TString::Format("bin %d  ---- entries %f  ---- weight %f  ---- Fs %f  ----- Fb %f", occupied[b].bin, occupied[b].entries, occupied[b].sumOfWeights, extended_signal, extended_bkg ));
+
+		    if(extended_signal + extended_bkg < 0) return false;
+			else if( extended_signal + extended_bkg > 0 )
+		    	sum.add( occupied[b].sumOfWeights * log( (extended_signal + extended_bkg) / total ) );
+		    }
+		    return true;
+	        }, extended_term);
+    }
+    else {
+	    // the event positions in the template binning do not depend on the parameters,
+	    // so they are looked up once and reused.
+	    const vector<int> &bins = data->getBinIndices(templateBinning);
+	    const columnSpan<double> weights = data->getWeightColumn();
+
+	    //loop over all data, split in chunks summed in a fixed order
+	    physical = parallelSum::run(Nentry, eventPool,
+	        [&](Long64_t begin, Long64_t end, kahanSum &sum){
+		    for(Long64_t event = begin; event < end; event++){
+			double tweight=weights[event];
+
+			double extended_signal =  signalContent[bins[event]] * signal_scale;
+			double extended_bkg    =  bkgContent[bins[event]];
+
+		    XE_DEBUG("computeTheLogLikelihood", TString::Format("bin %d  ---- weight %f  ---- Fs %f  ----- Fb %f", bins[event], tweight,extended_signal, extended_bkg ));
+
+		    // check physical result
+		    if(extended_signal + extended_bkg < 0) return false;
+			else if( extended_signal + extended_bkg > 0 )  // skipping the case of zero that ahime happens even tough my reccomendations on templates.
+		    	sum.add( tweight * log( (extended_signal + extended_bkg) / total ) ); //data weight is 1 for DM data and whatever for asimov
+		    }
+		    return true;
+	        }, extended_term);
+    }
+
+    if(!physical) {
+	Warning("pdfLikelihood::computeTheLogLikelihood" , "NsFs + NbFb < 0 ");
+	return VERY_SMALL;
     }
 
     LL += extended_term ;
    //---------------------------------------------------------------//
-      Debug("pdfLikelihood::computeTheLogLikelihood" , Form(" Extended term %f ", extended_term ));
+      XE_DEBUG("pdfLikelihood::computeTheLogLikelihood" , Form(" Extended term %f ", extended_term ));
 
 
 
@@ -390,13 +425,13 @@ double pdfLikelihood::computeTheLogLikelihood() {
 	     // in this case safeguard can bring problem.
 		 double epsilon = safeGuardParam->getCurrentValue() / safeguard_scaling;
 
-		Debug("pdfLikelihood::computeTheLogLikelihood" , Form(" PoissonTerm %f ",Nobs * log(Ns + Nb ) -Ns - Nb ));
+		XE_DEBUG("pdfLikelihood::computeTheLogLikelihood" , Form(" PoissonTerm %f ",Nobs * log(Ns + Nb ) -Ns - Nb ));
 
 	     if(  epsilon <= 0. && safeGuardPosDef ) {
 				 Warning("computeTheLogLikelihood", "safeguard not safe");
 			     return VERY_SMALL;
 	     }
-			 LL += LLsafeGuard();
+			 LL += withDensityMatrix ? LLsafeGuardFromDensities() : LLsafeGuardFromWorkspace();
 		//Info("pdfLikelihood::computeTheLogLikelihood" , Form(" Safeguard %f ", safeGuardParam->getCurrentValue() ));
      }
    //---------------------------------------------------------------//
@@ -405,12 +440,12 @@ double pdfLikelihood::computeTheLogLikelihood() {
    //----------------------- ADDING NP CONSTRAINTS -----------------//
       // this is now moved at higher level due to combination
 	  // (in combination one would otherwise consider this term twice)
-	  // it is done in likelihood::LikelihoodEvaluate()
+	  // it is done in Likelihood::evaluateMinusLogLikelihood()
    //---------------------------------------------------------------//
 
 
 
-	 Debug("computeTheLogLikelihood", Form("LogLike %f", LL));
+	 XE_DEBUG("computeTheLogLikelihood", Form("LogLike %f", LL));
 
   return LL;
 
@@ -422,6 +457,289 @@ double pdfLikelihood::computeTheLogLikelihood() {
 
 
 
+bool pdfLikelihood::computeTheLogLikelihoodGradient(double *gradient, GradientIndex &index) {
+
+    double sigma      = getPOI()->getCurrentValue();
+    double multiplier = getSignalMultiplier();
+
+    TRAVERSE_PARAMETERS(it) {
+	if(std::isnan((it->second)->getCurrentValue())) return false;
+    }
+
+    double epsilon = 0.;
+    if(withSafeGuard) {
+	epsilon = safeGuardParam->getCurrentValue() / safeguard_scaling;
+	// same rejection as computeTheLogLikelihood()
+	if(epsilon <= 0. && safeGuardPosDef) return false;
+    }
+
+    if(withDensityMatrix) fillDensityWorkspace();
+    else                  fillTemplateWorkspace();
+
+    double   Nb    = bkgIntegral;
+    double   Ns    = sigma * multiplier *  signalIntegral;
+    double   Nobs  = data->getSumOfWeights();
+
+    if( Ns + Nb <= 0.) return false;
+
+   //-------- weight / (NsFs + NbFb) of each bin or point ---------//
+    // LL = Nobs log(N) - N + sum_i w_i log(f_i / N), points with f_i = 0 are skipped
+    double usedWeights = 0.;
+
+    if(withDensityMatrix) {
+	gradientWeights.assign(dataMatrix.getNpoints(), 0.);
+
+	for(unsigned int p = 0; p < dataMatrix.getNpoints(); p++){
+	    double f = signalDensity[p] * sigma * multiplier + bkgDensity[p];
+	    if(f < 0.) return false;
+	    if(f == 0.) continue;
+	    gradientWeights[p] = dataMatrix.weights[p] / f;
+	    usedWeights       += dataMatrix.weights[p];
+	}
+    }
+    else {
+	gradientWeights.assign(signalContent.size(), 0.);
+
+	if(binnedOccupancy) {
+	    const vector<occupiedBin> &occupied = data->getOccupiedBins(templateBinning);
+
+	    for(unsigned int b = 0; b < occupied.size(); b++){
+		int bin  = occupied[b].bin;
+		double f = signalContent[bin] * sigma * multiplier + bkgContent[bin];
+		if(f < 0.) return false;
+		if(f == 0.) continue;
+		gradientWeights[bin] += occupied[b].sumOfWeights / f;
+		usedWeights          += occupied[b].sumOfWeights;
+	    }
+	}
+	else {
+	    const vector<int> &bins = data->getBinIndices(templateBinning);
+	    const columnSpan<double> weights = data->getWeightColumn();
+
+	    for(Long64_t event = 0; event < (Long64_t) weights.size(); event++){
+		int bin  = bins[event];
+		double f = signalContent[bin] * sigma * multiplier + bkgContent[bin];
+		if(f < 0.) return false;
+		if(f == 0.) continue;
+		double tweight = weights[event];
+		gradientWeights[bin] += tweight / f;
+		usedWeights          += tweight;
+	    }
+	}
+    }
+
+    //derivative of the LL wrt the total number of expected events
+    double dLLdN = (Nobs - usedWeights) / (Ns + Nb) - 1.;
+
+   //------- entries / (G + A) of each calibration bin or point -------//
+    // LLsafeguard = sum_j log(w_j (G_j + A_j) / (Nsg + A)), G the safeguarded template with
+    // integral Nsg, A the additional component: w_j drops out of the derivative.
+    double calibrationEntries = 0.;
+    double safeguardNorm      = safeguardIntegral;
+
+    if(withSafeGuard && withDensityMatrix) {
+	const double *additional = NULL;
+	if(safeguardAdditionalComponent) {
+	    int column     = calibrationMatrix.getColumn(safeguardAdditionalComponent);
+	    additional     = calibrationMatrix.getColumnData(column);
+	    safeguardNorm += calibrationMatrix.getColumnIntegral(column);
+	}
+
+	calibrationGradientWeights.assign(calibrationMatrix.getNpoints(), 0.);
+
+	for(unsigned int q = 0; q < calibrationMatrix.getNpoints(); q++){
+	    double g = calibrationDensity[q] + (additional ? additional[q] : 0.);
+	    if(calibrationMatrix.weights[q] / calibrationMatrix.entries[q] * g <= 0.) return false;
+	    calibrationGradientWeights[q] = calibrationMatrix.entries[q] / g;
+	    calibrationEntries           += calibrationMatrix.entries[q];
+	}
+    }
+    else if(withSafeGuard) {
+	const Float_t *additional = NULL;
+	if(safeguardAdditionalComponent) {
+	    additional     = safeguardAdditionalComponent->GetArray();
+	    safeguardNorm += safeguardAdditionalComponent->Integral();
+	}
+
+	calibrationGradientWeights.assign(safeguardContent.size(), 0.);
+
+	if(binnedOccupancy) {
+	    const vector<occupiedBin> &occupied = calibrationData->getOccupiedBins(templateBinning);
+
+	    for(unsigned int b = 0; b < occupied.size(); b++){
+		int bin  = occupied[b].bin;
+		double g = safeguardContent[bin] + (additional ? additional[bin] : 0.);
+		if(occupied[b].sumOfWeights / occupied[b].entries * g <= 0.) return false;
+		calibrationGradientWeights[bin] += occupied[b].entries / g;
+		calibrationEntries              += occupied[b].entries;
+	    }
+	}
+	else {
+	    const vector<int> &bins = calibrationData->getBinIndices(templateBinning);
+	    const columnSpan<double> weights = calibrationData->getWeightColumn();
+
+	    for(Long64_t event = 0; event < (Long64_t) weights.size(); event++){
+		int bin  = bins[event];
+		double g = safeguardContent[bin] + (additional ? additional[bin] : 0.);
+		if(weights[event] * g <= 0.) return false;
+		calibrationGradientWeights[bin] += 1. / g;
+		calibrationEntries              += 1.;
+	    }
+	}
+    }
+
+   //------------------ pieces of the overall template ------------------//
+    // f = sigma m S + G + O, O the bkg components not safeguarded and, with safeguard,
+    // G = (1 - eps) B + c S on the inner points, c = eps Nbs / Ssum, B the safeguarded
+    // components. The integral of G is Nbs whatever eps. Without safeguard all bkg is in O.
+    unsigned int  Npoints      = gradientWeights.size();
+    unsigned int  Ncalibration = withSafeGuard ? calibrationGradientWeights.size() : 0;
+
+    const double *signal            = withDensityMatrix ? &signalDensity[0] : &signalContent[0];
+    const double *calibrationSignal = withDensityMatrix ? calibrationSignalDensity.data() : signal;
+
+    densityMatrix *points            = withDensityMatrix ? &dataMatrix : NULL;
+    densityMatrix *calibrationPoints = withDensityMatrix ? &calibrationMatrix : NULL;
+
+    int nx = templateBinning->GetNbinsX() + 2;
+    int ny = templateBinning->GetNbinsY() + 2;
+
+    // the signal part of G is only on the inner bins, see fillTemplateWorkspace()
+    auto isInner = [&](densityMatrix *matrix, unsigned int p) -> bool {
+	if(matrix != NULL) return matrix->isInner[p];
+	int ix = p % nx, iy = p / nx;
+	return ix > 0 && ix < nx - 1 && iy > 0 && iy < ny - 1;
+    };
+
+    // adds the derivatives of S, B and O wrt param at the points of matrix (template bins if NULL),
+    // and returns the derivatives of their integrals. A NULL buffer is skipped.
+    auto addDerivatives = [&](LKParameter *param, densityMatrix *matrix, double *dS, double *dB, double *dO,
+                              double &dSsum, double &dBsum, double &dOsum) {
+	dSsum = matrix ? signal_component->addInterpolatedDensityDerivative(param, *matrix, dS)
+	               : signal_component->addInterpolatedDerivative(param, dS);
+	dBsum = dOsum = 0.;
+	for(unsigned int k=0; k < bkg_components.size(); k++){
+	    bool    isB    = withSafeGuard && safeguarded_bkg_components[k];
+	    double *target = isB ? dB : dO;
+	    if(target == NULL) continue;
+	    double d = matrix ? bkg_components[k]->addInterpolatedDensityDerivative(param, *matrix, target)
+	                      : bkg_components[k]->addInterpolatedDerivative(param, target);
+	    (isB ? dBsum : dOsum) += d;
+	}
+    };
+
+    // adds B, the safeguarded components at weight 1, at the points of matrix
+    auto addSafeguarded = [&](densityMatrix *matrix, double *B) {
+	for(unsigned int k=0; k < bkg_components.size(); k++){
+	    if(!safeguarded_bkg_components[k]) continue;
+	    if(matrix) bkg_components[k]->addInterpolatedDensity(*matrix, B);
+	    else       bkg_components[k]->addInterpolatedContent(B);
+	}
+    };
+
+    double Nbs = safeguardIntegral;
+    double c   = withSafeGuard ? epsilon * Nbs / signalIntegral : 0.;
+
+   //--------------------- loop on the parameters --------------------//
+    vector<LKParameter*> done;
+
+    TRAVERSE_PARAMETERS(it) {
+	LKParameter *param = it->second;
+
+	GradientIndex::iterator slot = index.find(param);
+	if(slot == index.end()) continue;
+
+	// a parameter can be registered more than once
+	if(find(done.begin(), done.end(), param) != done.end()) continue;
+	done.push_back(param);
+
+	double dN    = 0.;   // derivative of the expected events
+	double dPdf  = 0.;   // derivative of the sum over the data points
+	double dCal  = 0.;   // derivative of the sum over the calibration points
+	double dNsg  = 0.;   // derivative of the integral of G
+
+	if(param == getPOI()) {
+	    dN = multiplier * signalIntegral;
+	    for(unsigned int p = 0; p < Npoints; p++)
+		dPdf += gradientWeights[p] * multiplier * signal[p];
+	}
+	else if(withSafeGuard && param == safeGuardParam) {
+	    // dG/deps = c / eps S on the inner points - B, nothing else depends on eps
+	    double dEpsilon = 1. / safeguard_scaling;
+
+	    safeguardedBuffer.assign(Npoints, 0.);
+	    addSafeguarded(points, &safeguardedBuffer[0]);
+	    for(unsigned int p = 0; p < Npoints; p++)
+		dPdf += gradientWeights[p] * dEpsilon * ((isInner(points, p) ? Nbs / signalIntegral * signal[p] : 0.) - safeguardedBuffer[p]);
+
+	    if(withDensityMatrix) {
+		calibrationSafeguardedBuffer.assign(Ncalibration, 0.);
+		addSafeguarded(calibrationPoints, &calibrationSafeguardedBuffer[0]);
+	    }
+	    const double *B = withDensityMatrix ? &calibrationSafeguardedBuffer[0] : &safeguardedBuffer[0];
+
+	    for(unsigned int q = 0; q < Ncalibration; q++)
+		dCal += calibrationGradientWeights[q] * dEpsilon * ((isInner(calibrationPoints, q) ? Nbs / signalIntegral * calibrationSignal[q] : 0.) - B[q]);
+	}
+	else {
+	    bool used = signal_component->dependsOn(param);
+	    for(unsigned int k=0; k < bkg_components.size(); k++)
+		used = used || bkg_components[k]->dependsOn(param);
+	    if(!used) continue;
+
+	    signalBuffer.assign(Npoints, 0.);
+	    safeguardedBuffer.assign(Npoints, 0.);
+	    gradientBuffer.assign(Npoints, 0.);
+
+	    double dSsum = 0., dBsum = 0., dOsum = 0.;
+	    addDerivatives(param, points, &signalBuffer[0], &safeguardedBuffer[0], &gradientBuffer[0], dSsum, dBsum, dOsum);
+
+	    double dc = withSafeGuard ? epsilon * (dBsum * signalIntegral - Nbs * dSsum) / (signalIntegral * signalIntegral) : 0.;
+
+	    for(unsigned int p = 0; p < Npoints; p++){
+		double dG = withSafeGuard ? (1. - epsilon) * safeguardedBuffer[p] : 0.;
+		if(withSafeGuard && isInner(points, p)) dG += dc * signal[p] + c * signalBuffer[p];
+		dPdf += gradientWeights[p] * (sigma * multiplier * signalBuffer[p] + gradientBuffer[p] + dG);
+	    }
+
+	    if(withSafeGuard) {
+		const double *dS = &signalBuffer[0];
+		const double *dB = &safeguardedBuffer[0];
+
+		if(withDensityMatrix) {
+		    calibrationSignalBuffer.assign(Ncalibration, 0.);
+		    calibrationSafeguardedBuffer.assign(Ncalibration, 0.);
+		    double unused = 0.;
+		    addDerivatives(param, calibrationPoints, &calibrationSignalBuffer[0], &calibrationSafeguardedBuffer[0], NULL, unused, unused, unused);
+		    dS = &calibrationSignalBuffer[0];
+		    dB = &calibrationSafeguardedBuffer[0];
+		}
+
+		for(unsigned int q = 0; q < Ncalibration; q++){
+		    double dG = (1. - epsilon) * dB[q];
+		    if(isInner(calibrationPoints, q)) dG += dc * calibrationSignal[q] + c * dS[q];
+		    dCal += calibrationGradientWeights[q] * dG;
+		}
+	    }
+
+	    dN   = sigma * multiplier * dSsum + dBsum + dOsum;
+	    dNsg = dBsum;
+	}
+
+	double derivative = dLLdN * dN + dPdf;
+	if(withSafeGuard) derivative += dCal - calibrationEntries * dNsg / safeguardNorm;
+
+	gradient[slot->second] += derivative;
+
+	XE_DEBUG("computeTheLogLikelihoodGradient", TString::Format("dLL/d%s = %f", param->getName().Data(), derivative));
+    }
+
+    return true;
+}
+
+
+
+
 void  pdfLikelihood::drawAllOnProjection(bool isS1Projection){
 
    histoCompare comp = getModelCompare();
@@ -530,7 +848,7 @@ TH2F pdfLikelihood::getSafeguardedBkgPdfOnly(){
 
 	     TH2F temp_bkgPdf (bkg_components[k]->getInterpolatedHisto());
 
-		 Debug("getSafeguardedBkgPdfOnly",TString::Format("component %s  n-events = %f",temp_bkgPdf.GetName(), temp_bkgPdf.Integral()));
+		 XE_DEBUG("getSafeguardedBkgPdfOnly",TString::Format("component %s  n-events = %f",temp_bkgPdf.GetName(), temp_bkgPdf.Integral()));
 	     standard_integral += temp_bkgPdf.Integral();
 
 	     // Nb_k *(1 -epsilon) Fb_k(x,y)
@@ -544,7 +862,7 @@ TH2F pdfLikelihood::getSafeguardedBkgPdfOnly(){
      // Adding Nb*epsilon*Fs
 	 TH2F Fs (signal_component->getInterpolatedHisto());
 
-	 Debug("getSafeguardedBkgPdfOnly", TString::Format("safeguard_value %f   corresponding to events = %f  and Nb= %f", epsilon, epsilon * Nb_safeguard, Nb_safeguard ));
+	 XE_DEBUG("getSafeguardedBkgPdfOnly", TString::Format("safeguard_value %f   corresponding to events = %f  and Nb= %f", epsilon, epsilon * Nb_safeguard, Nb_safeguard ));
 	 //bkg_plusSafeguard.Add(&Fs, epsilon * Nb_safeguard / Fs.Integral() ) ;
 	 plotHelpers::addHisto(&bkg_plusSafeguard, &Fs, epsilon * Nb_safeguard / Fs.Integral() );
 
@@ -572,7 +890,7 @@ TH2F pdfLikelihood::getSafeguardedBkgPdf(){
 	     if(safeguarded_bkg_components[k])  continue;
 
 	     TH2F temp_bkgPdf (bkg_components[k]->getInterpolatedHisto());
-		 Debug("getSafeguardedBkgPdfOnly",TString::Format("component %s  n-events = %f",temp_bkgPdf.GetName(), temp_bkgPdf.Integral()));
+		 XE_DEBUG("getSafeguardedBkgPdfOnly",TString::Format("component %s  n-events = %f",temp_bkgPdf.GetName(), temp_bkgPdf.Integral()));
 	     safeguard_only.Add(&temp_bkgPdf);
       }
 
@@ -609,67 +927,325 @@ bool pdfLikelihood::isNegativeAnywhere(TH2F histo){
 
 double pdfLikelihood::LLsafeGuard(){
 
+	fillTemplateWorkspace();
+
+	return LLsafeGuardFromWorkspace();
+}
+
+
+double pdfLikelihood::LLsafeGuardFromWorkspace(){
+
      double LL = 0;
 
      Long64_t Nentry = calibrationData->getEntries();
 
-     TH2F safeguard_only = getSafeguardedBkgPdfOnly();
+	XE_DEBUG("pdfLikelihood::LLSafeguard" , Form("Calibration NEntry %lli", Nentry));
+
+     //adding the "additional" component: meant to be for AC which is different
+     const Float_t *additional = NULL;
+     double safeguard_only_integral = safeguardIntegral;
+
+     if(safeguardAdditionalComponent) {
+	     additional = safeguardAdditionalComponent->GetArray();
+	     safeguard_only_integral += safeguardAdditionalComponent->Integral();
+		 XE_DEBUG("LLsafeGuard", TString::Format("Additional component integral %f", safeguardAdditionalComponent->Integral()));
+	 }
+
+     if(binnedOccupancy) {
+	     // events of a bin are taken with their mean weight, which is exact for unit weight
+	     // calibration trees and for asimov samples (one event per bin).
+	     const vector<occupiedBin> &occupied = calibrationData->getOccupiedBins(templateBinning);
+
+	     bool physical = parallelSum::run(occupied.size(), eventPool,
+	         [&](Long64_t begin, Long64_t end, kahanSum &sum){
+		     for(Long64_t b = begin; b < end; b++){
+			     int bin = occupied[b].bin;
+			     double NbFb = occupied[b].sumOfWeights / occupied[b].entries * ( safeguardContent[bin] + (additional ? additional[bin] : 0.) );
+
+			     if(NbFb <=0) {
+				     cout << "pdfLikelihood::computeTheLogLikelihood - WARNING : safeGuard component <= 0. " << NbFb << endl;
+				     return false;
+			     }
 
-     //Check that the PDF is positive everywhere, gives trouble otherwise.
-     /*if(isNegativeAnywhere(safeguard_only)){
-	     	return VERY_SMALL;
+			     sum.add( occupied[b].entries * log( NbFb / safeguard_only_integral ) );
+		     }
+		     return true;
+	         }, LL);
+
+	     if(!physical) return VERY_SMALL;
+
+	     XE_DEBUG("LLsafeGuard", TString::Format("LL safeguard term %f", LL));
+	     return LL;
+     }
+
+     const vector<int> &calibrationBins = calibrationData->getBinIndices(templateBinning);
+     const columnSpan<double> calibrationWeights = calibrationData->getWeightColumn();
+
+     //loop over all data, split in chunks summed in a fixed order
+     bool physical = parallelSum::run(Nentry, eventPool,
+         [&](Long64_t begin, Long64_t end, kahanSum &sum){
+	     for(Long64_t event = begin; event < end; event++){
+	       double tweight=calibrationWeights[event];
+	       int bin = calibrationBins[event];
+
+		     //Nb*Fb(1-epsilon) + epsilon*Nb*Fs
+		     double NbFb =  tweight * ( safeguardContent[bin] + (additional ? additional[bin] : 0.) );
+
+		     // check physical result
+		     if(NbFb <=0) {
+		     	cout << "pdfLikelihood::computeTheLogLikelihood - WARNING : safeGuard component <= 0. " << NbFb << endl;
+		     	return false;
+		     }
+
+		     sum.add( log( NbFb / safeguard_only_integral ) );
+	     }
+	     return true;
+         }, LL);
+
+     if(!physical) return VERY_SMALL;
+
+	XE_DEBUG("LLsafeGuard", TString::Format("LL safeguard term %f", LL));
+    return LL ;
+
+}
+
+
+void pdfLikelihood::prepareTemplateBinning(){
+
+	if(templateBinning != NULL) return;
+
+	// all templates must share the binning of the signal
+	int Ncells = signal_component->getNcells();
+
+	for(unsigned int k=0; k < bkg_components.size(); k++){
+		if(bkg_components[k]->getNcells() != Ncells)
+			Error("prepareTemplateBinning", "bkg component " + bkg_components[k]->getComponentName() + " has a binning different from the signal.");
+	}
+
+	templateBinning = new TH2F(signal_component->getDefaultHisto());
+	templateBinning->Reset();
+	templateBinning->SetDirectory(0);
+}
+
+
+void pdfLikelihood::setNumberOfThreads(int n){
+
+	nThreads = n;
+
+	// the threads are started once and kept for all the evaluations
+	delete eventPool;
+	eventPool = (nThreads > 1) ? new workerPool(nThreads) : NULL;
+}
+
+
+void pdfLikelihood::prepareConcurrentEvaluation(){
+
+	prepareTemplateBinning();
+
+	signal_component->preloadHistos();
+	for(unsigned int k=0; k < bkg_components.size(); k++) bkg_components[k]->preloadHistos();
+}
+
+
+void pdfLikelihood::fillDensityWorkspace(){
+
+	prepareTemplateBinning();
+
+	dataMatrix.update(data, templateBinning, binnedOccupancy);
+
+	unsigned int Npoints = dataMatrix.getNpoints();
+
+	// assign() reuses the buffers once they are allocated
+	signalDensity.assign(Npoints, 0.);
+	bkgDensity.assign(Npoints, 0.);
+
+	signalIntegral = signal_component->addInterpolatedDensity(dataMatrix, signalDensity.data());
+	bkgIntegral    = 0.;
+
+	if(!withSafeGuard){
+		for(unsigned int k=0; k < bkg_components.size(); k++)
+			bkgIntegral += bkg_components[k]->addInterpolatedDensity(dataMatrix, bkgDensity.data());
+
+		return;
 	}
-	*/
 
-	Debug("pdfLikelihood::LLSafeguard" , Form("Calibration NEntry %lli", Nentry));
+	if(numberOfSafeguarded() == 0)
+		Error("fillDensityWorkspace", "none of the bkg component is safeguarded, use: addBkgPdfComponent(pdfComponent *addMe , bool Safeguarded = true)");
+
+	calibrationMatrix.update(calibrationData, templateBinning, binnedOccupancy);
+
+	unsigned int Ncalibration = calibrationMatrix.getNpoints();
+
+	calibrationSignalDensity.assign(Ncalibration, 0.);
+	calibrationDensity.assign(Ncalibration, 0.);
+
+	signal_component->addInterpolatedDensity(calibrationMatrix, calibrationSignalDensity.data());
+
+	double Nb_safeguard = 0.;
+	double epsilon      = safeGuardParam->getCurrentValue() / safeguard_scaling;
+
+	//computing Nb(1-epsilon)Fb for the safegurded components, at both data and calibration points
+	for(unsigned int k=0; k < bkg_components.size(); k++){
+		if(!safeguarded_bkg_components[k])  continue;
+		Nb_safeguard += bkg_components[k]->addInterpolatedDensity(dataMatrix, bkgDensity.data(), 1. - epsilon);
+		bkg_components[k]->addInterpolatedDensity(calibrationMatrix, calibrationDensity.data(), 1. - epsilon);
+	}
+
+	// Adding Nb*epsilon*Fs, only on the inner bins as in getSafeguardedBkgPdfOnly()
+	double signal_scale = epsilon * Nb_safeguard / signalIntegral;
+
+	for(unsigned int p=0; p < Npoints; p++)
+		if(dataMatrix.isInner[p]) bkgDensity[p] += signal_scale * signalDensity[p];
+
+	for(unsigned int p=0; p < Ncalibration; p++)
+		if(calibrationMatrix.isInner[p]) calibrationDensity[p] += signal_scale * calibrationSignalDensity[p];
+
+	// equal to Nb_safeguard by construction, the content is cross checked in fillTemplateWorkspace()
+	safeguardIntegral = (1. - epsilon) * Nb_safeguard + signal_scale * signalIntegral;
+
+	if( safeguardIntegral <= 0.)
+		Error("fillDensityWorkspace", TString::Format("safeguarded bkg has integral %f", safeguardIntegral));
+
+	//adding up all the other non safeguarded components
+	bkgIntegral = safeguardIntegral;
+
+	for(unsigned int k=0; k < bkg_components.size(); k++){
+		if(safeguarded_bkg_components[k])  continue;
+		bkgIntegral += bkg_components[k]->addInterpolatedDensity(dataMatrix, bkgDensity.data());
+	}
+}
+
+
+double pdfLikelihood::LLsafeGuardFromDensities(){
+
+     double LL = 0;
 
      //adding the "additional" component: meant to be for AC which is different
+     const double *additional = NULL;
+     double safeguard_only_integral = safeguardIntegral;
+
      if(safeguardAdditionalComponent) {
-	     safeguard_only.Add(safeguardAdditionalComponent);
-		 Debug("LLsafeGuard", TString::Format("Additional component integral %f", safeguardAdditionalComponent->Integral()));
+	     int column = calibrationMatrix.getColumn(safeguardAdditionalComponent);
+	     additional = calibrationMatrix.getColumnData(column);
+	     safeguard_only_integral += calibrationMatrix.getColumnIntegral(column);
 	 }
 
-     double safeguard_only_integral=safeguard_only.Integral();
-     //if(printLevel > 4)  cout << "safeguard_only_integral=safeguard_only.Integral  = " << safeguard_only_integral << endl;
-     //loop over all data
-     for(Long64_t event = 0; event < Nentry; event++){
-       double ts1=calibrationData->getS1(event);
-       double ts2=calibrationData->getS2(event);
-       double tweight=calibrationData->getW(event);
-
-	   // Debug("pdfLikelihood::LLSafeguard" , Form("Calibration Event: S1 %f ; S2 %f ; weight %f",ts1, ts2, tweight));
-
-	     //loads data TNtuple entry
-	     //	     calibrationData->getEntry(event);
-	     //Nb*Fb(1-epsilon) + epsilon*Nb*Fs
-	     //	     double NbFb =  calibrationData->getValFromPdf(safeguard_only);
-             //	     double NbFb =  tweight * safeguard_only.GetBinContent(safeguard_only.GetXaxis()->FindBin(ts1), safeguard_only.GetYaxis()->FindBin(ts2));
-	     double NbFb =  tweight * safeguard_only.GetBinContent(safeguard_only.FindBin(ts1,ts2));
-
-	     // check physical result
-	     if(NbFb <=0) {
-	     	cout << "pdfLikelihood::computeTheLogLikelihood - WARNING : safeGuard component <= 0. " << NbFb << endl;
-	     	return VERY_SMALL;
-	     }
+     bool physical = parallelSum::run(calibrationMatrix.getNpoints(), eventPool,
+         [&](Long64_t begin, Long64_t end, kahanSum &sum){
+	     for(Long64_t p = begin; p < end; p++){
 
-	     //	     LL +=  log( NbFb / safeguard_only.Integral() ) ;
-	     LL +=  log( NbFb / safeguard_only_integral ) ;
+		     // mean weight of the point, the weight itself when points are events
+		     double NbFb = calibrationMatrix.weights[p] / calibrationMatrix.entries[p] * ( calibrationDensity[p] + (additional ? additional[p] : 0.) );
 
-	     //if(printLevel > 4)    cout<<"....................... - INFO : Safeguard NB*Fb(x)" << NbFb << "  LL for data i " << LL << endl;
-     }
+		     if(NbFb <=0) {
+			     cout << "pdfLikelihood::computeTheLogLikelihood - WARNING : safeGuard component <= 0. " << NbFb << endl;
+			     return false;
+		     }
+
+		     sum.add( calibrationMatrix.entries[p] * log( NbFb / safeguard_only_integral ) );
+	     }
+	     return true;
+         }, LL);
+
+     if(!physical) return VERY_SMALL;
 
-	Debug("LLsafeGuard", TString::Format("LL safeguard term %f", LL));
+	XE_DEBUG("LLsafeGuard", TString::Format("LL safeguard term %f", LL));
     return LL ;
+}
+
+
+void pdfLikelihood::fillTemplateWorkspace(){
 
+	prepareTemplateBinning();
+
+	int Ncells = signal_component->getNcells();
+
+	// assign() reuses the buffers once they are allocated
+	signalContent.assign(Ncells, 0.);
+	bkgContent.assign(Ncells, 0.);
+
+	signalIntegral = signal_component->addInterpolatedContent(&signalContent[0]);
+	bkgIntegral    = 0.;
+
+	if(!withSafeGuard){
+		for(unsigned int k=0; k < bkg_components.size(); k++)
+			bkgIntegral += bkg_components[k]->addInterpolatedContent(&bkgContent[0]);
+
+		return;
+	}
+
+	if(numberOfSafeguarded() == 0)
+		Error("fillTemplateWorkspace", "none of the bkg component is safeguarded, use: addBkgPdfComponent(pdfComponent *addMe , bool Safeguarded = true)");
+
+	safeguardContent.assign(Ncells, 0.);
+
+	double Nb_safeguard = 0.;
+	double epsilon      = safeGuardParam->getCurrentValue() / safeguard_scaling;
+
+	//computing Nb(1-epsilon)Fb for the safegurded components
+	for(unsigned int k=0; k < bkg_components.size(); k++){
+		if(!safeguarded_bkg_components[k])  continue;
+		Nb_safeguard += bkg_components[k]->addInterpolatedContent(&safeguardContent[0], 1. - epsilon);
+	}
+
+	// Adding Nb*epsilon*Fs, only on the inner bins as in getSafeguardedBkgPdfOnly()
+	double signal_scale = epsilon * Nb_safeguard / signalIntegral;
+	int    nx           = templateBinning->GetNbinsX() + 2;
+	int    ny           = templateBinning->GetNbinsY() + 2;
+
+	for(int iy = 1; iy < ny - 1; iy++)
+		for(int ix = 1; ix < nx - 1; ix++)
+			safeguardContent[ix + nx * iy] += signal_scale * signalContent[ix + nx * iy];
+
+	safeguardIntegral = (1. - epsilon) * Nb_safeguard + signal_scale * signalIntegral;
+
+	XE_DEBUG("fillTemplateWorkspace", TString::Format("safeguard_value %f   corresponding to events = %f  and Nb= %f", epsilon, epsilon * Nb_safeguard, Nb_safeguard ));
+
+	//cross check on the filled template, the integral above is Nb_safeguard by algebra
+	double filledIntegral = 0.;
+	for(int iy = 1; iy < ny - 1; iy++)
+		for(int ix = 1; ix < nx - 1; ix++)
+			filledIntegral += safeguardContent[ix + nx * iy];
+
+	if( fabs(filledIntegral - Nb_safeguard) > 0.001 || safeguardIntegral <= 0.)
+		Error("fillTemplateWorkspace", TString::Format("probability is not conserved in safeguard: %f != %f", filledIntegral, Nb_safeguard));
+
+	//adding up all the other non safeguarded components
+	bkgContent  = safeguardContent;
+	bkgIntegral = safeguardIntegral;
+
+	for(unsigned int k=0; k < bkg_components.size(); k++){
+		if(safeguarded_bkg_components[k])  continue;
+		bkgIntegral += bkg_components[k]->addInterpolatedContent(&bkgContent[0]);
+	}
 }
 
 
+vector<unsigned long> pdfLikelihood::getDataVersions(){
+
+	vector<unsigned long> versions;
+	if(data != NULL) versions.push_back(data->getVersion());
+	if(withSafeGuard && calibrationData != NULL) versions.push_back(calibrationData->getVersion());
+
+	return versions;
+}
+
 void pdfLikelihood::setTreeIndex(int index){
 
 	data->setTreeIndex(index);
 	if(withSafeGuard) calibrationData->setTreeIndex(index);
 }
 
+void pdfLikelihood::setToyEvents(int index, const vector<float> &cs1, const vector<float> &cs2,
+                                 const vector<pair<TString,double> > &trueParams, bool calibration,
+                                 const vector<int> &counts){
+
+	dataHandler *d = calibration ? calibrationData : data;
+	if(d == NULL) Error("setToyEvents", calibration ? "calibration data are not set." : "data are not set.");
+
+	d->setEvents(TString::Format("%s_toy_%d", calibration ? "Cal" : "DM", index), cs1, cs2, trueParams, counts);
+}
+
 pdfComponent* pdfLikelihood::getBkgComponent(TString search_name) {
 
 	for(unsigned int i=0; i < bkg_components.size(); i++){
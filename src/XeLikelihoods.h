@@ -10,6 +10,7 @@
 #include <iostream>
 #include <cstdio>
 #include <vector>
+#include <algorithm>
 #include <utility>      // std::pair, std::make_pair
 #include "dataHandler.h"
 
@@ -40,6 +41,11 @@ class pdfLikelihood : public ProfileLikelihood {
 
 	double computeTheLogLikelihood();
 
+	/** \brief analytic derivatives of computeTheLogLikelihood() wrt sigma, the shape and scale sys
+	 * and, with safeguard, the safeguard parameter.
+	 */
+	bool   computeTheLogLikelihoodGradient(double *gradient, GradientIndex &index);
+
   	void generateAsimov(double mu_prime) ;
 
 	void generateAndUseAsimov(double mu_prime) {generateAsimov(mu_prime); useAsimovData() ;}
@@ -54,6 +60,11 @@ class pdfLikelihood : public ProfileLikelihood {
 
 	void   setTreeIndex(int index);
 
+	//! \brief same as setTreeIndex() with the toy events given in memory, calibration events for the safeguard.
+	void   setToyEvents(int index, const vector<float> &cs1, const vector<float> &cs2,
+	                    const vector<pair<TString,double> > &trueParams, bool calibration = false,
+	                    const vector<int> &counts = vector<int>());
+
 	void   setSignalDefaultNorm(double val) { siganlDefaultNorm = val; } ;
 
         double getCurrentNs();
@@ -64,7 +75,7 @@ class pdfLikelihood : public ProfileLikelihood {
 	// Safeguarded should be true, default is false.
 	void addBkgPdfComponent(pdfComponent *addMe , bool Safeguarded = false);
 
-	void setSignalPdf(pdfComponent *signal)  {signal_component = signal; };
+	void setSignalPdf(pdfComponent *signal)  {signal_component = signal; delete templateBinning; templateBinning = NULL; dataMatrix.reset(); calibrationMatrix.reset(); };
 
 	void setDataHandler(dataHandler *d )     {dmData = d; useDMData(); } ;
 
@@ -82,6 +93,15 @@ class pdfLikelihood : public ProfileLikelihood {
 
   void setSafeGuardPosDef(bool b)  {safeGuardPosDef = b;} ; //! Set whether safeguard should be forced to be possitive
 
+  //! Set whether the pdf terms loop over occupied template bins (events grouped per bin) instead of events.
+  void setBinnedOccupancy(bool b)  {binnedOccupancy = b;} ;
+
+  //! Set whether the templates are evaluated through a density matrix of the grid histos at the data points.
+  void setWithDensityMatrix(bool b)  {withDensityMatrix = b;} ;
+
+  //! Set the number of threads summing the per-event terms, the result does not depend on it (default 1).
+  void setNumberOfThreads(int n);
+
   void drawAllOnProjection(bool isS1Projection);
 
     /** \brief prints a summary of all bkg and signal events with current parameter choice
@@ -93,6 +113,8 @@ class pdfLikelihood : public ProfileLikelihood {
 
 	vector<double> getTrueParams()      { return data->getTrueParams(); };
 
+	vector<unsigned long> getDataVersions();
+
   double getSafeguardValue(); //! returns current value of safeguard
 
 
@@ -142,6 +164,30 @@ class pdfLikelihood : public ProfileLikelihood {
 
 	double LLsafeGuard();
 
+	/** \brief fills the template workspace (signalContent, bkgContent, safeguardContent)
+	 * for the current parameter values. This is what the likelihood evaluation uses: the
+	 * buffers are allocated once, no histogram is built per call.
+	 */
+	void   fillTemplateWorkspace();
+
+	//! \brief safeguard term on the calibration data, computed on the current workspace.
+	double LLsafeGuardFromWorkspace();
+
+	//! \brief creates templateBinning on first use, checking that all templates share the binning.
+	void   prepareTemplateBinning();
+
+	//! \brief builds templateBinning and reads all the histos of the components, see Likelihood::prepareConcurrentEvaluation().
+	void   prepareConcurrentEvaluation();
+
+	/** \brief fills the density workspace (signalDensity, bkgDensity, calibrationDensity)
+	 * at the data and calibration points, as linear combination of the density matrix columns.
+	 * The matrices are rebuilt only when the data change.
+	 */
+	void   fillDensityWorkspace();
+
+	//! \brief safeguard term on the calibration data, computed on the current density workspace.
+	double LLsafeGuardFromDensities();
+
 	//! \brief returns the number of bkg components that ask for safeguard
 	int   numberOfSafeguarded();
 
@@ -163,12 +209,62 @@ class pdfLikelihood : public ProfileLikelihood {
 
   bool                   safeGuardPosDef; //! Force safeguard parameter to be positive
 
+	bool                   binnedOccupancy; //! evaluate the pdf terms per occupied bin rather than per event
+
+	bool                   withDensityMatrix; //! evaluate the pdf terms through densityMatrix
+
+	int                    nThreads;          //! threads for the per-event sums
+
+	workerPool            *eventPool;         //! runs the chunks of the per-event sums, NULL if nThreads <= 1
+
 	double                 wimp_mass;
 
 	double                 safeguard_fixValue;
 
 	LKParameter            *safeGuardParam;
 
+	//------ template workspace, flat over the global bins of the templates ------//
+	TH2F                   *templateBinning;    //! empty copy of the signal template, defines the workspace binning
+
+	vector<double>          signalContent;      //! interpolated signal template, sigma not applied
+
+	vector<double>          bkgContent;         //! overall bkg template, safeguarded if requested
+
+	vector<double>          safeguardContent;   //! safeguarded bkg components only, for the fit to calibration
+
+	double                  signalIntegral;
+
+	double                  bkgIntegral;
+
+	double                  safeguardIntegral;
+
+	densityMatrix           dataMatrix;         //! grid histos at the data points
+
+	densityMatrix           calibrationMatrix;  //! grid histos at the calibration points
+
+	vector<double>          signalDensity;      //! interpolated signal at the data points, sigma not applied
+
+	vector<double>          bkgDensity;         //! overall bkg at the data points
+
+	vector<double>          calibrationSignalDensity; //! interpolated signal at the calibration points
+
+	vector<double>          calibrationDensity; //! safeguarded bkg components at the calibration points
+
+	vector<double>          gradientWeights;    //! weight over template value of each bin (or density point), for the gradient
+
+	vector<double>          gradientBuffer;     //! derivative of the bkg not safeguarded wrt one parameter
+
+	vector<double>          signalBuffer;       //! derivative of the signal template wrt one parameter
+
+	vector<double>          safeguardedBuffer;  //! safeguarded bkg components, or their derivative
+
+	vector<double>          calibrationGradientWeights;   //! entries over safeguard template of each calibration bin (or point)
+
+	vector<double>          calibrationSignalBuffer;      //! as signalBuffer, at the calibration points
+
+	vector<double>          calibrationSafeguardedBuffer; //! as safeguardedBuffer, at the calibration points
+	//-----------------------------------------------------------------------------//
+
 	double                  safeguard_scaling;
 
 	//This is needed for compatibility, ancestral xephyr roots.
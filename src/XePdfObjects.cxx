@@ -1,6 +1,9 @@
 #include "XePdfObjects.h"
 #include "TKey.h"
 
+// TFile reads are not thread safe: components of experiments evaluated concurrently share this lock
+static std::mutex fileMutex;
+
 
 scaleSys::scaleSys(TString name, double relativeUncertainty) : LKParameter(PAR_NOT_ASSIGNED, NUISANCE_PARAMETER, name.Data(), 0, 0.01, -5.,5.) {
 
@@ -55,7 +58,7 @@ double shapeSys::getNearestLow(){
 
 	if( getCurrentValue() == getMaximum() ) 
 		nearestLow = getMaximum() - getStep() ; 
-	Debug("ShapeSys::getnearestLow",Form(" nearstlow = %f",nearestLow));
+	XE_DEBUG("ShapeSys::getnearestLow",Form(" nearstlow = %f",nearestLow));
 
 	return nearestLow ;
 }
@@ -70,13 +73,184 @@ double shapeSys::getNearestHigh(){
 
 	// skip case of Sys with step == 0
 	if(getStep() == 0.) return getCurrentValue();
-	Debug("ShapeSys::getnearestHigh",Form(" nearstHigh = %f",getNearestLow()+getStep()));
+	XE_DEBUG("ShapeSys::getnearestHigh",Form(" nearstHigh = %f",getNearestLow()+getStep()));
 
 	return ( getNearestLow()  + getStep() ) ;
 
 
 }
 
+densityMatrix::densityMatrix() : errorHandler("densityMatrix") {
+
+	source        = NULL;
+	sourceVersion = 0;
+	sourceBinned  = false;
+}
+
+bool densityMatrix::update(dataHandler *src, TH2F *binning, bool binned){
+
+	if(src == NULL)
+		Error("update", "no data to take the points from.");
+
+	if(src == source && src->getVersion() == sourceVersion && binned == sourceBinned) return false;
+
+	source        = src;
+	sourceVersion = src->getVersion();
+	sourceBinned  = binned;
+
+	bins.clear();
+	weights.clear();
+	entries.clear();
+	isInner.clear();
+	content.clear();
+	integrals.clear();
+	columns.clear();
+
+	if(binned) {
+		const vector<occupiedBin> &occupied = src->getOccupiedBins(binning);
+		for(unsigned int b=0; b < occupied.size(); b++){
+			bins.push_back(occupied[b].bin);
+			weights.push_back(occupied[b].sumOfWeights);
+			entries.push_back(occupied[b].entries);
+		}
+	}
+	else {
+		const vector<int> &eventBins = src->getBinIndices(binning);
+		const columnSpan<double> eventWeights = src->getWeightColumn();
+		for(unsigned int event=0; event < eventBins.size(); event++){
+			bins.push_back(eventBins[event]);
+			weights.push_back(eventWeights[event]);
+			entries.push_back(1.);
+		}
+	}
+
+	int nx = binning->GetNbinsX() + 2;
+	int ny = binning->GetNbinsY() + 2;
+
+	for(unsigned int p=0; p < bins.size(); p++){
+		int ix = bins[p] % nx;
+		int iy = bins[p] / nx;
+		isInner.push_back( ix > 0 && ix < nx - 1 && iy > 0 && iy < ny - 1 );
+	}
+
+	Debug("update", TString::Format("%u points from %s", getNpoints(), src->Name.Data()));
+
+	return true;
+}
+
+int densityMatrix::getColumn(TH2F *h){
+
+	map<TH2F*, int>::iterator it = columns.find(h);
+	if(it != columns.end()) return it->second;
+
+	int column = integrals.size();
+
+	const Float_t *array = h->GetArray();
+	for(unsigned int p=0; p < bins.size(); p++)
+		content.push_back(array[bins[p]]);
+
+	integrals.push_back(h->Integral());
+	columns[h] = column;
+
+	return column;
+}
+
+
+
+templateSampler::templateSampler() : errorHandler("templateSampler") {
+
+	integral = 0.;
+}
+
+void templateSampler::build(const TH2F &h){
+
+	int nx = h.GetNbinsX();
+	int ny = h.GetNbinsY();
+	int n  = nx * ny;
+
+	xLow.resize(nx);  xWidth.resize(nx);
+	yLow.resize(ny);  yWidth.resize(ny);
+	for(int i=0; i < nx; i++) { xLow[i] = h.GetXaxis()->GetBinLowEdge(i+1); xWidth[i] = h.GetXaxis()->GetBinWidth(i+1); }
+	for(int j=0; j < ny; j++) { yLow[j] = h.GetYaxis()->GetBinLowEdge(j+1); yWidth[j] = h.GetYaxis()->GetBinWidth(j+1); }
+
+	// bin k = i + nx * j, same ordering as TH2::GetRandom2
+	probability.assign(n, 0.);
+	alias.assign(n, 0);
+	integral = 0.;
+	bool negative = false;
+	for(int j=0; j < ny; j++)
+		for(int i=0; i < nx; i++) {
+			double c = h.GetBinContent(i+1, j+1);
+			if(c < 0.) { negative = true; c = 0.; }
+			probability[i + nx * j] = c;
+			integral += c;
+		}
+
+	content = probability;
+
+	if(negative) Warning("build", TString("negative bins taken as empty in ") + h.GetName());
+	if(!(integral > 0.)) return;
+
+	// Vose: split the bins in under and over full (mean = 1), each under full bin is topped up by an over full one
+	vector<int> small, large;
+	for(int k=0; k < n; k++) {
+		probability[k] *= n / integral;
+		alias[k] = k;
+		if(probability[k] < 1.) small.push_back(k);
+		else                    large.push_back(k);
+	}
+
+	while(!small.empty() && !large.empty()) {
+		int s = small.back(); small.pop_back();
+		int l = large.back(); large.pop_back();
+
+		alias[s] = l;
+		probability[l] -= 1. - probability[s];
+
+		if(probability[l] < 1.) small.push_back(l);
+		else                    large.push_back(l);
+	}
+
+	// left overs are full up to rounding
+	for(unsigned int k=0; k < small.size(); k++) probability[small[k]] = 1.;
+	for(unsigned int k=0; k < large.size(); k++) probability[large[k]] = 1.;
+}
+
+void templateSampler::addContent(vector<double> &sum, double scale) const {
+
+	unsigned int n = min(sum.size(), content.size());
+
+	for(unsigned int k=0; k < n; k++) sum[k] += scale * content[k];
+}
+
+void templateSampler::getBinCentre(int k, double &x, double &y) const {
+
+	int nx = xLow.size();
+	int j  = k / nx;
+	int i  = k - nx * j;
+
+	x = xLow[i] + 0.5 * xWidth[i];
+	y = yLow[j] + 0.5 * yWidth[j];
+}
+
+void templateSampler::draw(TRandom &rng, double &x, double &y) const {
+
+	if(!(integral > 0.)) { x = 0.; y = 0.; return; }
+
+	int    nx = xLow.size();
+	double u  = rng.Rndm() * probability.size();
+	int    k  = TMath::Min((int) u, (int) probability.size() - 1);
+	if(u - k >= probability[k]) k = alias[k];
+
+	int j = k / nx;
+	int i = k - nx * j;
+
+	x = xLow[i] + xWidth[i] * rng.Rndm();
+	y = yLow[j] + yWidth[j] * rng.Rndm();
+}
+
+
+
 pdfComponent::pdfComponent(TString name, TString filename) : errorHandler("pdfComponent"), pdf_name(name), component_name(name) {
 
   	file = TFile::Open(filename);
@@ -99,6 +273,16 @@ pdfComponent::pdfComponent(TString name, TString filename) : errorHandler("pdfCo
 	suffix = "";
 
 	doExtend  = false;
+
+	gridIsValid = false;
+
+	interpolationVersion = 0;
+
+	contentVersion = 0;
+
+	histoVersion   = 0;
+
+	interpolatedHisto = NULL;
 }
 
 pdfComponent::pdfComponent(TString component_name, TString hist_name, TString filename) : errorHandler("pdfComponent"), pdf_name(hist_name), component_name(component_name) {
@@ -123,6 +307,16 @@ pdfComponent::pdfComponent(TString component_name, TString hist_name, TString fi
 	suffix = "";
 
 	doExtend  = false;
+
+	gridIsValid = false;
+
+	interpolationVersion = 0;
+
+	contentVersion = 0;
+
+	histoVersion   = 0;
+
+	interpolatedHisto = NULL;
 }
 
 pdfComponent::~pdfComponent(){
@@ -134,6 +328,8 @@ pdfComponent::~pdfComponent(){
 
 	delete defaultDistro;
 
+	delete interpolatedHisto;
+
 	InterpFactors.clear();
 
 	old_t_val.clear();
@@ -285,102 +481,119 @@ vector< shapeSys * > pdfComponent::scanFile(TString tag,char dd)
 
 void pdfComponent::loadHistos() {
 
-	//clear vector of pointers, this does not delete the histo
-	//from memory, they remain attached to the TFile, this is a wanted
-	//feature, we don't hit the disk each time, we put in memory all the
-	//histo that have been read for later access. Histo are not duplicated.
-	histos.clear();
-
-	InterpFactors.clear();
-
 	loadDefaultHisto();
 
 	//end here if no shape sys
-	if(myShapeUnc.size() ==0) return;
+	if(myShapeUnc.size() ==0) {
+		if(!old_t_val.empty()) {
+			old_t_val.clear();
+			interpolationVersion++;
+		}
+		histos.clear();
+		InterpFactors.clear();
+		return;
+	}
 
+	//the interpolation is lazy, nothing to do if none of the shape sys
+	//of this component moved since the last call.
+	bool rebuilt = checkGridIndex();
+	bool moved   = shapeSysMoved();
+	if(!rebuilt && !moved) return;
 
-	int sysToSkip = 0;
-	for(unsigned int k =0; k< myShapeUnc.size(); k++){
-		if ( myShapeUnc[k]->getStep() == 0. ) sysToSkip++;
-	}
-	
-	// total number of combination of point needed for 
+	interpolationVersion++;
 
-	// interpolation, 2^N_parameter. Each parameter can be loaded
-	// with his closest high/low end on the grid of that parameter.
-        // example: to interpolate Leff=0.5 we need to load Leff=0 and Leff=1
-	// histograms.
-	int N = pow(2, myShapeUnc.size());
+	//clear vector of pointers, this does not delete the histo
+	//from memory, they remain attached to the TFile, this is a wanted
+	//feature, we don't hit the disk each time, we put in memory all the
+	//histo that have been read for later access. Histo are not duplicated.
+	histos.clear();
 
-	N = N - sysToSkip;
-	
+	InterpFactors.clear();
 
 	//the idea is to compute the volume of the hypercube in parameter space
 	//corresponding to that grid point and divide by the total volume,
 	//this is the interpolation factor.
 	double total_vol = 1.;
 
-	//compute total volume
+	int sysToSkip = 0;
+
+	//find the nearest grid points of each parameter, once per call
 	for(unsigned int k =0; k< myShapeUnc.size(); k++){
 
-	  
+		gridLow[k] = 0;
+
 		// skip ShapeSys with step ==0 
-		if(myShapeUnc[k]->getStep() == 0.) continue;
+		double step = myShapeUnc[k]->getStep();
+		if(step == 0.) {
+			sysToSkip++;
+			continue;
+		}
+
+		double low  = myShapeUnc[k]->getNearestLow();
+		double high = low + step;
+		double val  = myShapeUnc[k]->getCurrentValue();
+
+		total_vol *= fabs( high - low );
 
-		total_vol *= fabs( myShapeUnc[k]->getNearestHigh() - 
+		distLow[k]  = fabs( val - low );
+		distHigh[k] = fabs( val - high );
 
-				myShapeUnc[k]->getNearestLow() );
+		gridLow[k]  = (int) floor( (low - myShapeUnc[k]->getMinimum()) / step + 0.5 );
 	}
 
-	//loop on the realization of parameter, we create a vector of bool
-	//that say for each parameter what "step" (point in grid) hast to be loaded,
-	//the low end or high end wrt the value asked.
-	for(int i=0; i < N; i++){
+	// total number of combination of point needed for 
+	// interpolation, 2^N_parameter. Each parameter can be loaded
+	// with his closest high/low end on the grid of that parameter.
+        // example: to interpolate Leff=0.5 we need to load Leff=0 and Leff=1
+	// histograms.
+	int N = (1 << myShapeUnc.size()) - sysToSkip;
 
-		vector <bool> grid_point;
+	//loop on the corners of the hypercube, bit k of i says if the
+	//low end (0) or the high end (1) of parameter k has to be loaded.
+	for(int i=0; i < N; i++){
 
 		double grid_point_vol = 1.;
 
+		int  index  = 0;
+		bool inGrid = true;
+
 		//loop on the parameter
 		for(unsigned int k =0; k< myShapeUnc.size(); k++){
 
-			int param_power = pow(2,k);
-			//if false load the histo corresponding to the low end
-			//of that parameter, the high end otherwise
-			int lowOrHigh = ( i / param_power) % 2 ;
-
-			
-			if(lowOrHigh == 0)       grid_point.push_back(false);
-			else if(lowOrHigh == 1)  grid_point.push_back(true);
-
-			else Error("loadHistos","something very wierd happened");
-
-
 			// skip if Step ==0
 			if( myShapeUnc[k]->getStep() == 0. ) continue;
 
+			int lowOrHigh = ( i >> k ) & 1;
+
 			//compute the numerator of iterpolation factor 
-      
 			//for this grid point, area of the opposite
-			if(lowOrHigh == 1)
-			    grid_point_vol *= fabs( myShapeUnc[k]->getCurrentValue() -
-					          myShapeUnc[k]->getNearestLow() );
-			else
-			    grid_point_vol *= fabs( myShapeUnc[k]->getCurrentValue() -
-					          myShapeUnc[k]->getNearestHigh() );
+			grid_point_vol *= lowOrHigh ? distLow[k] : distHigh[k];
 
+			int coordinate = gridLow[k] + lowOrHigh;
+			if(coordinate < 0 || coordinate >= gridSize[k]) inGrid = false;
+
+			index += coordinate * gridStride[k];
 		}
 
-		TString histName = getNearestHistoName(grid_point);
-//		Info("loadHistos","Loading histo: "+ histName + " interp. factor for  " + getParamValueString() + " : " +
-//				+ TString(printTools::formatF(grid_point_vol / total_vol)) ) ;
+		//points outside the declared range are not indexed, they are kept by name
+		TH2F *h = NULL;
+		if(inGrid) {
+			if(gridHistos[index] == NULL) gridHistos[index] = readGridHisto(i);
+			h = gridHistos[index];
+		}
+		else {
+			vector <bool> grid_point;
+			for(unsigned int k =0; k< myShapeUnc.size(); k++)
+				grid_point.push_back( (( i >> k ) & 1) == 1 );
+
+			TString histName = getNearestHistoName(grid_point);
+			map<TString, TH2F*>::iterator it = outOfGridHistos.find(histName);
+			if(it == outOfGridHistos.end()) it = outOfGridHistos.insert(make_pair(histName, readHisto(histName))).first;
+			h = it->second;
+		}
 
-		//check if name exist
-		if( file->FindKey(histName) == NULL)
-			Error("loadHistos","Histogram does not exist in file: "+histName);
 		//store histo pointer
-		histos.push_back((TH2F*)file->Get(histName));
-
+		histos.push_back(h);
 
 		//store the interpolation factor
 		InterpFactors.push_back( grid_point_vol / total_vol );
@@ -390,18 +603,132 @@ void pdfComponent::loadHistos() {
 
 }
 
+bool pdfComponent::shapeSysMoved(){
+
+	bool moved = old_t_val.size() != myShapeUnc.size();
+
+	old_t_val.resize(myShapeUnc.size(), -999.);
+
+	for(unsigned int k =0; k < myShapeUnc.size(); k++){
+		double val = myShapeUnc[k]->getCurrentValue();
+		if(old_t_val[k] != val) {
+			old_t_val[k] = val;
+			moved = true;
+		}
+	}
+
+	return moved;
+}
+
+bool pdfComponent::checkGridIndex(){
+
+	unsigned int nSys = myShapeUnc.size();
+
+	// the index is built for a given grid of each parameter, the user can
+	// still change step, range or suffix after registering the sys.
+	bool same = gridIsValid && gridKey.size() == 3 * nSys && gridSuffix == suffix;
+
+	for(unsigned int k =0; same && k < nSys; k++){
+		double step = myShapeUnc[k]->getStep();
+		// with step == 0 the histo name depends on the current value
+		double low  = step == 0. ? myShapeUnc[k]->getCurrentValue() : myShapeUnc[k]->getMinimum();
+		if(gridKey[3*k] != step || gridKey[3*k+1] != low || gridKey[3*k+2] != myShapeUnc[k]->getMaximum())
+			same = false;
+	}
+
+	if(same) return false;
+
+	gridKey.clear();
+	gridSize.assign(nSys, 1);
+	gridStride.assign(nSys, 0);
+	gridLow.assign(nSys, 0);
+	distLow.assign(nSys, 0.);
+	distHigh.assign(nSys, 0.);
+
+	int total = 1;
+
+	for(unsigned int k =0; k < nSys; k++){
+
+		double step = myShapeUnc[k]->getStep();
+
+		gridKey.push_back(step);
+		gridKey.push_back(step == 0. ? myShapeUnc[k]->getCurrentValue() : myShapeUnc[k]->getMinimum());
+		gridKey.push_back(myShapeUnc[k]->getMaximum());
+
+		if(step == 0.) continue;
+
+		gridSize[k]   = (int) lround( (myShapeUnc[k]->getMaximum() - myShapeUnc[k]->getMinimum()) / step ) + 1;
+		gridStride[k] = total;
+		total        *= gridSize[k];
+	}
+
+	gridHistos.assign(total, NULL);
+	gridSuffix  = suffix;
+	gridIsValid = true;
+
+	Debug("checkGridIndex", Form("grid index of %s built with %d points", pdf_name.Data(), total));
+
+	return true;
+}
+
+TH2F* pdfComponent::readGridHisto(int corner){
+
+	vector <bool> grid_point;
+
+	for(unsigned int k =0; k< myShapeUnc.size(); k++)
+		grid_point.push_back( (( corner >> k ) & 1) == 1 );
+
+	return readHisto(getNearestHistoName(grid_point));
+}
+
+TH2F* pdfComponent::readHisto(TString histName, bool required){
+
+	std::lock_guard<std::mutex> lock(fileMutex);
+
+	//check if name exist
+	if( file->FindKey(histName) == NULL) {
+		if(!required) return NULL;
+		Error("readHisto","Histogram does not exist in file: "+histName);
+	}
+
+	return (TH2F*)file->Get(histName);
+}
+
 void pdfComponent::loadDefaultHisto(){
 
-  if(defaultDistro == NULL) {
+  if(defaultDistro == NULL) defaultDistro = readHisto(getDefaultHistoName());
 
-       if( file->FindKey(getDefaultHistoName()) == NULL)
-	Error("loadDefaultHisto","histo name " +getDefaultHistoName() + "  not found in ");
+}
 
-	defaultDistro    = (TH2F*)file->Get(getDefaultHistoName());
+void pdfComponent::preloadHistos(){
 
-  }
+	loadDefaultHisto();
 
+	if(myShapeUnc.size() == 0) return;
 
+	// a new index starts empty, make the next loadHistos() pick the histos again
+	if(checkGridIndex()) old_t_val.clear();
+
+	for(unsigned int index=0; index < gridHistos.size(); index++){
+
+		if(gridHistos[index] != NULL) continue;
+
+		// same name as getNearestHistoName() for the grid point of index
+		TString histName(pdf_name);
+		for(unsigned int k =0; k< myShapeUnc.size(); k++){
+			double step  = myShapeUnc[k]->getStep();
+			double value = myShapeUnc[k]->getCurrentValue();
+			if(step != 0.) value = myShapeUnc[k]->getMinimum() + ((index / gridStride[k]) % gridSize[k]) * step;
+
+			histName += TString(myShapeUnc[k]->getName()) + TString::Format("%.2f", value);
+		}
+		if(suffix != "") histName.Append(suffix);
+
+		// a grid not aligned on the declared minimum is left to the lazy read of loadHistos()
+		gridHistos[index] = readHisto(histName, false);
+	}
+
+	Debug("preloadHistos", Form("%u grid histos of %s in memory", (unsigned int) gridHistos.size(), pdf_name.Data()));
 }
 
 
@@ -467,24 +794,13 @@ TString pdfComponent::getDefaultHistoName(){
 
 double pdfComponent::getNormalizedDensity(double s1, double s2) {
 
-	//load histogram according to the current value of the parameters
-	loadHistos();
+	//interpolated template according to the current value of the parameters
+	const double *shape = getShapeContent();
 
 	int s1_bin = defaultDistro->GetXaxis()->FindBin(s1);
 	int s2_bin = defaultDistro->GetYaxis()->FindBin(s2);
 
-	//use single histo if no shape uncertainties
-	double interpolated_content = defaultDistro->GetBinContent(s1_bin, s2_bin);
-
-	//use single histo if no shape uncertainties
-	if(myShapeUnc.size() > 0) {
-
-            interpolated_content = 0.;
-	    for(unsigned int k=0; k< histos.size(); k++){
-		interpolated_content += histos[k]->GetBinContent(s1_bin, s2_bin) * InterpFactors[k];
-	    }
-
-	 }
+	double interpolated_content = shape[defaultDistro->GetBin(s1_bin, s2_bin)];
 
 	//scale uncertainty part
 	for(unsigned int k=0; k < myScaleUnc.size() ; k++){
@@ -519,19 +835,10 @@ double pdfComponent::getDefaultDensity(double s1, double s2){
 
 double  pdfComponent::getNormalizedEvents() {
 
-	//load histogram according to the current value of the parameters
-	loadHistos();
+	//interpolated template according to the current value of the parameters
+	getShapeContent();
 
-	//use default histo if no shape uncertainties
-	double all_content = defaultDistro->Integral();
-
-	//use single histo if no shape uncertainties
-	if(myShapeUnc.size() > 0 ) {
-            all_content = 0.;
-	    for(unsigned int k=0; k< histos.size(); k++){
-		all_content += histos[k]->Integral() * InterpFactors[k];
-	    }
-	}
+	double all_content = interpolatedIntegral;
 
 	//scale uncertainty part
 	for(unsigned int k=0; k < myScaleUnc.size() ; k++){
@@ -574,15 +881,22 @@ TH2F   pdfComponent::getInterpolatedHisto(){
 	//clone default
 	TH2F h_temp = getDefaultHisto() ;
 
-	Debug("getinterpolated","Interp_" + getParamValueString());
+	XE_DEBUG("getinterpolated","Interp_" + getParamValueString());
 	
 	if(myShapeUnc.size() > 0) {
-	    h_temp = *histos[0];
-            h_temp.Reset();
-	    for(unsigned int k=0; k< histos.size(); k++)
-		h_temp.Add(histos[k], InterpFactors[k]);
+	    //the sum over the grid histos is redone only if the shape sys moved
+	    if(interpolatedHisto == NULL || histoVersion != interpolationVersion) {
+		delete interpolatedHisto;
+		interpolatedHisto = new TH2F(*histos[0]);
+		interpolatedHisto->SetDirectory(0);
+		interpolatedHisto->Reset();
+		for(unsigned int k=0; k< histos.size(); k++)
+		    interpolatedHisto->Add(histos[k], InterpFactors[k]);
+		histoVersion = interpolationVersion;
+	    }
+	    h_temp = *interpolatedHisto;
 
-	    //getDefault is scaled, but reset function bring back content to zero
+	    //getDefault is scaled, the cached sum is not
 	    if(scaleFactor > 0.) h_temp.Scale(scaleFactor);
 	}
 
@@ -600,6 +914,230 @@ TH2F   pdfComponent::getInterpolatedHisto(){
 	return h_temp;
 }
 
+double pdfComponent::addInterpolatedContent(double *content, double weight){
+
+	//interpolated template according to the current value of the parameters
+	const double *shape = getShapeContent();
+
+	double norm = 1.;
+	if(scaleFactor > 0.) norm *= scaleFactor;
+
+	//scale uncertainty part
+	for(unsigned int k=0; k < myScaleUnc.size() ; k++)
+		norm *= myScaleUnc[k]->getNormModifier();
+
+	double factor = weight * norm;
+
+	unsigned int nCells = interpolatedContent.size();
+	for(unsigned int bin = 0; bin < nCells; bin++)
+		content[bin] += factor * shape[bin];
+
+	return norm * interpolatedIntegral;
+}
+
+const double* pdfComponent::getShapeContent(){
+
+	//load histogram according to the current value of the parameters
+	loadHistos();
+
+	if(!interpolatedContent.empty() && contentVersion == interpolationVersion)
+		return &interpolatedContent[0];
+
+	int nx = defaultDistro->GetNbinsX() + 2;
+	int ny = defaultDistro->GetNbinsY() + 2;
+
+	interpolatedContent.assign(nx * ny, 0.);
+	interpolatedIntegral = 0.;
+
+	//use default histo if no shape uncertainties
+	unsigned int nTemplates = myShapeUnc.size() > 0 ? histos.size() : 1;
+
+	for(unsigned int k=0; k < nTemplates; k++){
+
+		const Float_t *h  = myShapeUnc.size() > 0 ? histos[k]->GetArray() : defaultDistro->GetArray();
+		double factor     = myShapeUnc.size() > 0 ? InterpFactors[k] : 1.;
+
+		for(int iy = 0; iy < ny; iy++){
+			bool innerRow = (iy > 0 && iy < ny - 1);
+			for(int ix = 0; ix < nx; ix++){
+				int bin      = ix + nx * iy;
+				double value = factor * h[bin];
+				interpolatedContent[bin] += value;
+				if(innerRow && ix > 0 && ix < nx - 1) interpolatedIntegral += value;
+			}
+		}
+	}
+
+	contentVersion = interpolationVersion;
+
+	return &interpolatedContent[0];
+}
+
+double pdfComponent::addInterpolatedDensity(densityMatrix &matrix, double *density, double weight){
+
+	//load histogram according to the current value of the parameters
+	loadHistos();
+
+	double norm = 1.;
+	if(scaleFactor > 0.) norm *= scaleFactor;
+
+	//scale uncertainty part
+	for(unsigned int k=0; k < myScaleUnc.size() ; k++)
+		norm *= myScaleUnc[k]->getNormModifier();
+
+	unsigned int Npoints = matrix.getNpoints();
+
+	double integral = 0.;
+
+	//use default histo if no shape uncertainties
+	unsigned int nTemplates = myShapeUnc.size() > 0 ? histos.size() : 1;
+
+	for(unsigned int k=0; k < nTemplates; k++){
+
+		int column    = matrix.getColumn(myShapeUnc.size() > 0 ? histos[k] : defaultDistro);
+		double factor = myShapeUnc.size() > 0 ? norm * InterpFactors[k] : norm;
+
+		const double *col = matrix.getColumnData(column);
+		for(unsigned int p=0; p < Npoints; p++)
+			density[p] += weight * factor * col[p];
+
+		integral += factor * matrix.getColumnIntegral(column);
+	}
+
+	return integral;
+}
+
+bool pdfComponent::dependsOn(LKParameter *param){
+
+	for(unsigned int j=0; j < myScaleUnc.size() ; j++)
+		if(myScaleUnc[j] == param) return true;
+
+	for(unsigned int j=0; j < myShapeUnc.size() ; j++)
+		if(myShapeUnc[j] == param) return true;
+
+	return false;
+}
+
+bool pdfComponent::computeDerivativeFactors(LKParameter *param){
+
+	if(!dependsOn(param)) return false;
+
+	//load histogram according to the current value of the parameters
+	loadHistos();
+
+	double scale = scaleFactor > 0. ? scaleFactor : 1.;
+
+	double norm = scale;
+	for(unsigned int k=0; k < myScaleUnc.size() ; k++)
+		norm *= myScaleUnc[k]->getNormModifier();
+
+	//derivative of the scale sys product, leaving out the derived modifier
+	double dNorm = 0.;
+	for(unsigned int j=0; j < myScaleUnc.size() ; j++){
+		if(myScaleUnc[j] != param) continue;
+
+		double others = scale;
+		for(unsigned int k=0; k < myScaleUnc.size() ; k++)
+			if(k != j) others *= myScaleUnc[k]->getNormModifier();
+
+		dNorm += others * myScaleUnc[j]->getNormModifierDerivative();
+	}
+
+	//use default histo if no shape uncertainties
+	if(myShapeUnc.size() == 0) {
+		derivativeFactors.assign(1, dNorm);
+		return true;
+	}
+
+	derivativeFactors.assign(histos.size(), 0.);
+
+	for(unsigned int i=0; i < histos.size(); i++){
+
+		derivativeFactors[i] = dNorm * InterpFactors[i];
+
+		//interpolation factor is a product of distances, one per parameter (see loadHistos)
+		for(unsigned int j=0; j < myShapeUnc.size() ; j++){
+			if(myShapeUnc[j] != param || myShapeUnc[j]->getStep() == 0.) continue;
+
+			// the high end factor grows with the value, the low end one decreases
+			double dFactor = ( (i >> j) & 1 ) ? 1. : -1.;
+
+			for(unsigned int k=0; k < myShapeUnc.size() ; k++){
+				double step = myShapeUnc[k]->getStep();
+				if(step == 0.) continue;
+				if(k != j) dFactor *= ( (i >> k) & 1 ) ? distLow[k] : distHigh[k];
+				dFactor /= step;
+			}
+
+			derivativeFactors[i] += norm * dFactor;
+		}
+	}
+
+	return true;
+}
+
+double pdfComponent::addInterpolatedDerivative(LKParameter *param, double *content, double weight){
+
+	if(!computeDerivativeFactors(param)) return 0.;
+
+	int nx = defaultDistro->GetNbinsX() + 2;
+	int ny = defaultDistro->GetNbinsY() + 2;
+
+	double integral = 0.;
+
+	for(unsigned int k=0; k < derivativeFactors.size(); k++){
+
+		if(derivativeFactors[k] == 0.) continue;
+
+		const Float_t *h  = myShapeUnc.size() > 0 ? histos[k]->GetArray() : defaultDistro->GetArray();
+		double factor     = derivativeFactors[k];
+
+		for(int iy = 0; iy < ny; iy++){
+			bool innerRow = (iy > 0 && iy < ny - 1);
+			for(int ix = 0; ix < nx; ix++){
+				int bin      = ix + nx * iy;
+				double value = factor * h[bin];
+				content[bin] += weight * value;
+				if(innerRow && ix > 0 && ix < nx - 1) integral += value;
+			}
+		}
+	}
+
+	return integral;
+}
+
+double pdfComponent::addInterpolatedDensityDerivative(LKParameter *param, densityMatrix &matrix, double *density, double weight){
+
+	if(!computeDerivativeFactors(param)) return 0.;
+
+	unsigned int Npoints = matrix.getNpoints();
+
+	double integral = 0.;
+
+	for(unsigned int k=0; k < derivativeFactors.size(); k++){
+
+		if(derivativeFactors[k] == 0.) continue;
+
+		int column    = matrix.getColumn(myShapeUnc.size() > 0 ? histos[k] : defaultDistro);
+		double factor = derivativeFactors[k];
+
+		const double *col = matrix.getColumnData(column);
+		for(unsigned int p=0; p < Npoints; p++)
+			density[p] += weight * factor * col[p];
+
+		integral += factor * matrix.getColumnIntegral(column);
+	}
+
+	return integral;
+}
+
+int pdfComponent::getNcells(){
+
+	loadDefaultHisto();
+
+	return (defaultDistro->GetNbinsX() + 2) * (defaultDistro->GetNbinsY() + 2);
+}
+
 TH2F   pdfComponent::getDefaultHisto(){
 
 	loadDefaultHisto();
@@ -852,6 +1390,8 @@ void pdfComponent::replaceUncertainty(TString name, shapeSys* newShape){
 		}
 	}
 
+	gridIsValid = false;
+
 	if(found == false) Error("replaceUncertainty", name + " not found.");
 
 
@@ -54,6 +54,9 @@ class scaleSys : public LKParameter {
 		// Uses the current t-value which is automatically linked to its pdfLikelihood
 		double getNormModifier();
 
+		// derivative of getNormModifier() wrt the t-value
+		double getNormModifierDerivative() { return relUnc; };
+
 
 		//this case return a sys that is centered in zero, half a gaussian, t-value strictly positive
 		//and for a tvalue=0 have zero events. Histo is supposed to be normalized to 1
@@ -67,6 +70,96 @@ class scaleSys : public LKParameter {
 };
 
 
+/**
+ * \class densityMatrix
+ * \brief content of the templates at a fixed set of evaluation points (events or occupied bins).
+ *
+ * Each column holds one grid histogram read at all the points, it is filled the first time
+ * that histogram is used. An interpolated density at the points is then a linear combination
+ * of columns (see pdfComponent::addInterpolatedDensity), with no histogram arithmetic.
+ */
+class densityMatrix : public errorHandler {
+
+   public:
+	densityMatrix();
+
+	//! \brief takes the evaluation points from source, in the binning of binning, if the events changed since the last call.
+	/**
+	 * points are the events, or the occupied bins if binned is true. Returns true if the matrix was rebuilt.
+	 */
+	bool update(dataHandler *source, TH2F *binning, bool binned);
+
+	//! \brief forces a rebuild at the next update().
+	void reset() { source = NULL; };
+
+	//! returns the column of histo h, reading it at all the points if needed.
+	int  getColumn(TH2F *h);
+
+	const double* getColumnData(int column) { return content.empty() ? NULL : &content[column * getNpoints()]; };
+
+	double getColumnIntegral(int column) { return integrals[column]; };
+
+	unsigned int getNpoints() { return bins.size(); };
+
+	vector<int>             bins;       //! global bin of each point
+	vector<double>          weights;    //! summed data weight of each point
+	vector<double>          entries;    //! number of events of each point
+	vector<char>            isInner;    //! false for points in under/overflow bins
+
+   private:
+	vector<double>          content;    //! column major, getNpoints() values per column
+	vector<double>          integrals;  //! integral (no under/overflow) of each column histo
+	map<TH2F*, int>         columns;
+
+	dataHandler            *source;
+	unsigned long           sourceVersion;
+	bool                    sourceBinned;
+};
+
+
+/**
+ * \class templateSampler
+ * \brief draws (x,y) from a 2D template through an alias table of its bins.
+ *
+ * The table is built once per template (Walker/Vose), each draw is then O(1): one bin from
+ * the table and a uniform point within the bin, like TH2::GetRandom2. Under/overflow bins are
+ * not sampled, negative bins are taken as empty. The generator is passed to draw(), no global
+ * generator is touched.
+ */
+class templateSampler : public errorHandler {
+
+   public:
+	templateSampler();
+
+	//! \brief builds the alias table of h.
+	void build(const TH2F &h);
+
+	//! \brief draws (x,y), returns (0,0) if the template is empty.
+	void draw(TRandom &rng, double &x, double &y) const;
+
+	//! integral (no under/overflow) of the template at build().
+	double getIntegral() const { return integral; };
+
+	bool   isBuilt() const { return !xLow.empty(); };
+
+	unsigned int getNbins() const { return content.size(); };
+
+	//! \brief adds scale times the content of each bin to sum, bins ordered like draw(). Sizes must match.
+	void   addContent(vector<double> &sum, double scale) const;
+
+	//! \brief centre of bin k.
+	void   getBinCentre(int k, double &x, double &y) const;
+
+   private:
+	vector<double>          content;      //! bin contents, negative bins set to 0
+	vector<double>          probability;  //! probability of keeping bin i, else alias[i] is taken
+	vector<int>             alias;
+	vector<double>          xLow, xWidth; //! bin edges, so that draw() does not go through the axes
+	vector<double>          yLow, yWidth;
+	double                  integral;
+};
+
+
 class pdfComponent :public errorHandler{
 
    public:
@@ -82,20 +175,23 @@ class pdfComponent :public errorHandler{
 	 * the "tag" is the histogram prefix, the points in parameter space must be equally 
 	 * separated.
 	 */
-	void autoLoad(TString tag="",char dd='_') {myShapeUnc=(scanFile(tag,dd));};
+	void autoLoad(TString tag="",char dd='_') {myShapeUnc=(scanFile(tag,dd)); gridIsValid = false;};
 
 	vector< shapeSys * > scanFile(TString tag="",char dd='_');
 	
 	void addScaleSys(scaleSys *addMe) { myScaleUnc.push_back(addMe); };
 
-	void addShapeSys(shapeSys *addMe) { myShapeUnc.push_back(addMe); };
+	void addShapeSys(shapeSys *addMe) { myShapeUnc.push_back(addMe); gridIsValid = false;};
 
-	//! load histogram according to the current value of the parameters
+	//! load histogram according to the current value of the parameters, does nothing if the shape sys did not move since the last call
 	void loadHistos();
 
 	//! load default histogram, no sys.
 	void loadDefaultHisto();
 
+	//! \brief reads the default histo and every grid histo of the shape sys, so that the following fits do not touch the file.
+	void preloadHistos();
+
 	//! returns the interpolated pdf over shape sys computed in (s1,s2).
 	/**
 	 * it is normalized to number of events and scale uncertainty are also taken into account
@@ -121,6 +217,37 @@ class pdfComponent :public errorHandler{
 	//! Returns a copy of the default histogram, no shape nor scale sys is applied
 	TH2F  getDefaultHisto();
 
+	//! \brief adds weight times the interpolated template to content, without building any histogram.
+	/**
+	 * content is a flat array indexed by the global bin of the templates (getNcells() long),
+	 * shape and scale sys are applied as in getInterpolatedHisto(). Returns the integral of the
+	 * interpolated template (weight not applied, under/overflow excluded).
+	 */
+	double addInterpolatedContent(double *content, double weight = 1.);
+
+	//! returns the number of global bins (under/overflow included) of the templates.
+	int    getNcells();
+
+	//! \brief same as addInterpolatedContent, but at the points of matrix only.
+	/**
+	 * density is getNpoints() long. The interpolated template is the combination of the
+	 * matrix columns of the loaded grid histos. Returns the integral of the interpolated template.
+	 */
+	double addInterpolatedDensity(densityMatrix &matrix, double *density, double weight = 1.);
+
+	//! returns true if param is one of the shape or scale sys of this component.
+	bool   dependsOn(LKParameter *param);
+
+	//! \brief same as addInterpolatedContent, but adds the derivative of the template wrt param.
+	/**
+	 * The shape interpolation is linear within a grid cell, so the derivative is exact
+	 * (one sided on the grid points). Returns the derivative of the integral.
+	 */
+	double addInterpolatedDerivative(LKParameter *param, double *content, double weight = 1.);
+
+	//! \brief same as addInterpolatedDerivative, but at the points of matrix only.
+	double addInterpolatedDensityDerivative(LKParameter *param, densityMatrix &matrix, double *density, double weight = 1.);
+
 	//! returns the grid points in histogram space that needs to be loaded. this method need to be modified for arbitrary number of shape sys.
 	TString getNearestHistoName(vector<bool> setOfVal);
 
@@ -182,9 +309,50 @@ class pdfComponent :public errorHandler{
 	vector<double>			old_t_val;    /** contains the last value interpolated, the interpolation is lazy, doesn't ricompute it if is for the same set of values.*/
 	double                          scaleFactor;
 
+	unsigned long			interpolationVersion; /** incremented each time histos and InterpFactors are recomputed */
+	vector<double>			interpolatedContent;  /** interpolated template over the global bins, scale sys and scaleFactor not applied */
+	double				interpolatedIntegral; /** integral of interpolatedContent, under/overflow excluded */
+	unsigned long			contentVersion;       /** interpolationVersion interpolatedContent was computed at */
+	TH2F				*interpolatedHisto;   /** same as interpolatedContent, as a histo for getInterpolatedHisto() */
+	unsigned long			histoVersion;         /** interpolationVersion interpolatedHisto was computed at */
+
+	vector<TH2F*>			gridHistos;   /** grid histos indexed by the grid coordinates of the shape sys, read from file on first use */
+	vector<int>			gridSize;     /** number of grid points of each shape sys */
+	vector<int>			gridStride;   /** stride of each shape sys in gridHistos */
+	vector<double>			gridKey;      /** step, min and max of each shape sys (value if step == 0) the index was built for */
+	TString				gridSuffix;   /** suffix the index was built for */
+	bool				gridIsValid;
+	vector<int>			gridLow;      /** scratch: grid coordinate of the nearest low point of each shape sys */
+	vector<double>			distLow;      /** scratch: distance of the current value from the nearest low point */
+	vector<double>			distHigh;     /** scratch: distance of the current value from the nearest high point */
+	vector<double>			derivativeFactors; /** scratch: derivative of the factor of each template wrt one parameter */
+	map<TString, TH2F*>		outOfGridHistos; /** histos of the corners outside the declared range, by name, read on first use */
+
 
 	void extendHisto(TH2F &h);
 
+	//! \brief (re)builds the grid index if the shape sys or the suffix changed since the last build, returns true if rebuilt.
+	bool checkGridIndex();
+
+	//! returns true if any shape sys value changed since the last call, and records the new values in old_t_val.
+	bool shapeSysMoved();
+
+	//! \brief returns interpolatedContent, recomputed only if the shape sys moved.
+	const double* getShapeContent();
+
+	//! reads from file the histo of the i-th corner of the interpolation hypercube.
+	TH2F* readGridHisto(int corner);
+
+	//! \brief reads histName from file, the reads of all components are serialized. A missing histo is an error if required, else NULL.
+	TH2F* readHisto(TString histName, bool required = true);
+
+	//! \brief fills derivativeFactors, the derivative wrt param of the factor of each loaded template.
+	/**
+	 * the templates are histos, or only the default one without shape sys. Returns false if
+	 * the component does not depend on param.
+	 */
+	bool  computeDerivativeFactors(LKParameter *param);
+
 };
 
 
@@ -194,6 +194,13 @@ double LKParameter::getLLGausConstraint(){
 	return ( -1 * (t - t0)  * (t - t0)  /2. );  // t0 is the current measure
 }
 
+double LKParameter::getLLGausConstraintDerivative(){
+	//no constraint if free
+	if(getType() == FREE_PARAMETER ) return 0.;
+
+	return ( -1 * (getCurrentValue() - t0) );
+}
+
 
 bool LKParameter::compares(LKParameter* par,bool prnt){
   if(id!=par->getId()) {
@@ -399,7 +406,7 @@ TEfficiencyParameter::TEfficiencyParameter() : LKParameter(PAR_EFFICIENCY_TVALUE
 
 //--------------- virtual class for Likelihood computation --------
 
-Likelihood::~Likelihood()                     {clear();}
+Likelihood::~Likelihood()                     {clear(); delete minimizer;}
 Likelihood::Likelihood(TString nam) : XeStat(nam) {
   setup();
 }
@@ -416,6 +423,10 @@ void Likelihood::setup(){
   seed =0;
   sigmaHat           = UNDEFINED;
   LogD               = UNDEFINED;
+  withAnalyticGradient = false;
+  minimizer          = NULL;
+  warmStartMode      = WARM_START_OFF;
+  minimizerAtMinimum = false;
 }
 
 void Likelihood::clear(){
@@ -712,6 +723,38 @@ bool Likelihood::checkConsistency(){
   return true;
 }
 
+void ParameterBlock::build(map<int,LKParameter*> &parameters, vector<LKParameter*> &minuitParameters){
+  params.clear();
+  values.clear();
+  t0.clear();
+  types.clear();
+  minuitSlot.clear();
+  minuitUnits.clear();
+
+  map<LKParameter*,int> slot;
+  for(map<int,LKParameter*>::iterator it=parameters.begin(); it!=parameters.end(); it++) {
+    LKParameter *p=it->second;
+    slot[p] = params.size();
+    params.push_back(p);
+    values.push_back(p->getCurrentValue());
+    t0.push_back(p->getT0value());
+    types.push_back(p->getType());
+  }
+
+  for(unsigned int m=0; m < minuitParameters.size(); m++) {
+    minuitSlot.push_back(slot[minuitParameters[m]]);
+    minuitUnits.push_back(minuitParameters[m]->getMinuitUnit());
+  }
+
+  valid = true;
+}
+
+bool ParameterBlock::hasNaN() const {
+  for(unsigned int k=0; k < values.size(); k++)
+    if(std::isnan(values[k])) return true;
+  return false;
+}
+
 int Likelihood::mapMinuitParameters(bool freeze){
   MinuitParameters.clear();
   TRAVERSE_PARAMETERS(it) {
@@ -722,6 +765,7 @@ int Likelihood::mapMinuitParameters(bool freeze){
       MinuitParameters.push_back(p);
     }
   }
+  block.build(parameters, MinuitParameters);
   int np=MinuitParameters.size();
   return np;
 }
@@ -736,8 +780,14 @@ void Likelihood::setCurrentValues( const double *values,const double *errs) {
 
 void Likelihood::setCurrentValuesInMinuitUnits( const double *v,const double *e) {
   int n=getNMinuitParameters();
+  bool dense=block.isValid();
   for(int p=0;p<n;p++) {
-    MinuitParameters[p]->setCurrentValueInMinuitUnits(v[p]);
+    if(dense) {
+      double value = v[p] * block.minuitUnits[p];
+      block.values[block.minuitSlot[p]] = value;
+      MinuitParameters[p]->setCurrentValue(value);
+    }
+    else MinuitParameters[p]->setCurrentValueInMinuitUnits(v[p]);
     if(e!=NULL) MinuitParameters[p]->setSigmaInMinuitUnits(e[p]);
   }
 }
@@ -747,46 +797,201 @@ void Likelihood::setCurrentValuesInMinuitUnits( const double *v,const double *e)
 double Likelihood::computeTheConstraint(){
   double LL = 0.;
 
+  // during a fit the constraints are computed on the dense block
+  if(block.isValid()) {
+    for(unsigned int k=0; k < block.values.size(); k++) {
+      if(block.types[k] != NUISANCE_PARAMETER && block.types[k] != FIXED_PARAMETER) continue;
+
+      double t = block.values[k] - block.t0[k];
+      LL += -1 * t * t / 2.;
+      XE_DEBUG("computeTheConstraint", TString::Format("constraint of param %s is %f for tval=%f",
+                block.params[k]->getName().Data(), -1 * t * t / 2., block.values[k] ));
+    }
+    return LL;
+  }
+
   TRAVERSE_PARAMETERS(it) {
 	  if( (it->second)->getType() == NUISANCE_PARAMETER  || (it->second)->getType() == FIXED_PARAMETER) {
 
       double costraint = (it->second)->getLLGausConstraint();
       LL +=   costraint;
-      Debug("computeTheConstraint", TString::Format("constraint of param %s is %f for tval=%f",
+      XE_DEBUG("computeTheConstraint", TString::Format("constraint of param %s is %f for tval=%f",
                 (it->second)->getName().Data(), costraint, (it->second)->getCurrentValue() ));
     }
     else
-      Debug("computeTheConstraint", "skipping costraint on param "+ (it->second)->getName());
+      XE_DEBUG("computeTheConstraint", "skipping costraint on param "+ (it->second)->getName());
   }
 
   return LL;
 
 }
 
-//-- Only external static function could work!!! <-- ALE, THIS IS NOT TRUE!
-//look here: https://root.cern.ch/how-implement-mathematical-function-inside-framework
-//Functor can call also methods of a class, clean this mess... FIXME.
-static Likelihood*  currentLikelihood;
+void Likelihood::computeTheConstraintGradient(double *gradient, GradientIndex &index){
 
-double LikelihoodEvaluate (const double * values) {
-  currentLikelihood->setCurrentValuesInMinuitUnits(values); // write the current values to LKParameters
+  TRAVERSE_PARAMETERS(it) {
+	  LKParameter *p = it->second;
+	  if( p->getType() != NUISANCE_PARAMETER  && p->getType() != FIXED_PARAMETER) continue;
 
+	  GradientIndex::iterator slot = index.find(p);
+	  if(slot != index.end()) gradient[slot->second] += p->getLLGausConstraintDerivative();
+  }
+}
+
+void Likelihood::mapGradientIndex(){
+  gradientIndex.clear();
+  int n=getNMinuitParameters();
+  for(int p=0;p<n;p++) {
+    gradientIndex[MinuitParameters[p]] = p;
+
+    // a combined parameter moves all the parameters it correlates
+    CombinedParameter *combined = dynamic_cast<CombinedParameter*>(MinuitParameters[p]);
+    if(combined == NULL) continue;
+    for(unsigned int i=0 ; i < combined->paramList.size(); i++)
+      gradientIndex[combined->paramList[i]] = p;
+  }
+}
+
+bool Likelihood::computeTheGradient(double *gradient){
+  int n=getNMinuitParameters();
+  for(int p=0;p<n;p++) gradient[p] = 0.;
+
+  if(!computeTheLogLikelihoodGradient(gradient, gradientIndex)) return false;
+  computeTheConstraintGradient(gradient, gradientIndex);
 
-  if( errorHandler::globalPrintLevel < 1) { //Debug print
+  // Minuit minimizes -LL in Minuit units
+  for(int p=0;p<n;p++) gradient[p] *= -1. * MinuitParameters[p]->getMinuitUnit();
+
+  return true;
+}
+
+double Likelihood::evaluateMinusLogLikelihood (const double * values) {
+  setCurrentValuesInMinuitUnits(values); // write the current values to LKParameters
+
+
+  if(getPrintLevel() < 1) { //Debug print
     cout<<"Evaluating likelihood "<<endl;
-    currentLikelihood->printCurrentParameters();
+    printCurrentParameters();
   }
-  double logLikeWithConstraint = currentLikelihood->computeTheLogLikelihood() + currentLikelihood->computeTheConstraint() ;
+  double logLikeWithConstraint = computeTheLogLikelihood() + computeTheConstraint() ;
   double e= -1. * logLikeWithConstraint;
-  if(errorHandler::globalPrintLevel < 1) {
+  if(getPrintLevel() < 1) {
     cout<<"             .... result:"<<printTools::formatF(e,19,8)<<endl;
   }
   return e;
 }
 
+void Likelihood::computeNumericalGradient(const double *values, double *gradient){
+  int n=getNMinuitParameters();
+  vector<double> shifted(values, values + n);
+
+  // central differences, one sided at the limits
+  for(int p=0;p<n;p++) {
+    double h    = 1.E-5 * max(1., fabs(values[p]));
+    double up   = min(values[p] + h, MinuitParameters[p]->getMaximumInMinuitUnits());
+    double down = max(values[p] - h, MinuitParameters[p]->getMinimumInMinuitUnits());
+
+    shifted[p] = up;
+    double e_up = evaluateMinusLogLikelihood(&shifted[0]);
+    shifted[p] = down;
+    double e_down = evaluateMinusLogLikelihood(&shifted[0]);
+    shifted[p] = values[p];
+
+    gradient[p] = up > down ? (e_up - e_down) / (up - down) : 0.;
+  }
+
+  setCurrentValuesInMinuitUnits(values);
+}
+
+void Likelihood::evaluateMinusLogLikelihoodGradient (const double * values, double * gradient) {
+  setCurrentValuesInMinuitUnits(values); // write the current values to LKParameters
+
+  // the likelihood can refuse for the current values (e.g. unphysical region)
+  if(!computeTheGradient(gradient))
+    computeNumericalGradient(values, gradient);
+}
+
+double LikelihoodFunction::DoEval (const double * values) const {
+  return likelihood->evaluateMinusLogLikelihood(values);
+}
+
+void LikelihoodFunction::Gradient (const double * values, double * gradient) const {
+  likelihood->evaluateMinusLogLikelihoodGradient(values, gradient);
+}
+
+double LikelihoodFunction::DoDerivative (const double * values, unsigned int coordinate) const {
+  vector<double> gradient(nDim);
+  Gradient(values, &gradient[0]);
+  return gradient[coordinate];
+}
+
+void Likelihood::setMinimizerVariables(const vector<double> &start){
+  int np=getNMinuitParameters();
+  for(int i=0;i<np;i++){
+    LKParameter* par=MinuitParameters[i];
+   TString pnS= par->getName();
+    string pn = pnS.Data();
+    double v=start[i];
+    double s = par->getStepInMinuitUnits();
+    //double s= par->getStepInMinuitUnits(); // don't ask why but the factor 100 is needed for better convergence
+    double vmi=par->getMinimumInMinuitUnits();
+    double vma=par->getMaximumInMinuitUnits();
+    if(getPrintLevel() < 1) {
+      double v0=v * par->getMinuitUnit();
+      double s0=par->getStep();
+      double vmi0=par->getMinimum();
+      double vma0=par->getMaximum();
+      cout<<"Setting parameter "<<(i+1)<<": "<<pn<<endl
+      <<"      Initial value  :"<<v0<<" min:"<<vmi0<<" max:"<<vma0<<" step:"<<s0
+      <<endl
+      <<"      In Minuit units:"<< v<<" min:"<<vmi <<" max:"<<vma <<" step:"<<s
+      <<endl;
+    }
+    minimizer->SetLimitedVariable(i,pn.c_str(),v,s,vmi,vma);
+  }
+}
+
+bool Likelihood::getWarmStartValues(vector<double> &start){
+  if(warmStartPoints.empty() || parameters.find(PAR_SIGMA) == parameters.end()) return false;
+  double mu = parameters[PAR_SIGMA]->getCurrentValue();
+
+  // the two converged points nearest to mu
+  map<double, map<LKParameter*,double> >::iterator first  = warmStartPoints.end();
+  map<double, map<LKParameter*,double> >::iterator second = warmStartPoints.end();
+  for(map<double, map<LKParameter*,double> >::iterator it=warmStartPoints.begin(); it!=warmStartPoints.end(); it++) {
+    double d = fabs(it->first - mu);
+    if(first == warmStartPoints.end() || d < fabs(first->first - mu)) { second = first; first = it; }
+    else if(second == warmStartPoints.end() || d < fabs(second->first - mu)) second = it;
+  }
+  bool linear = (warmStartMode == WARM_START_LINEAR && second != warmStartPoints.end());
+
+  int np=getNMinuitParameters();
+  for(int i=0;i<np;i++){
+    LKParameter* par=MinuitParameters[i];
+    map<LKParameter*,double>::iterator v1 = first->second.find(par);
+    if(v1 == first->second.end()) continue;   // not fitted there, keep the initial value
+
+    double v = v1->second;
+    if(linear) {
+      map<LKParameter*,double>::iterator v2 = second->second.find(par);
+      if(v2 != second->second.end()) v += (mu - first->first) * (v1->second - v2->second) / (first->first - second->first);
+    }
+    v = max(par->getMinimum(), min(par->getMaximum(), v));
+    start[i] = v / par->getMinuitUnit();
+  }
+  return true;
+}
+
+void Likelihood::storeWarmStartPoint(){
+  if(parameters.find(PAR_SIGMA) == parameters.end()) return;
+
+  map<LKParameter*,double> &point = warmStartPoints[parameters[PAR_SIGMA]->getCurrentValue()];
+  int np=getNMinuitParameters();
+  for(int i=0;i<np;i++) point[MinuitParameters[i]] = MinuitParameters[i]->getCurrentValue();
+}
+
 double Likelihood::maximize(bool freezeParametersOfInterest){
-  currentLikelihood=this;
   int np=mapMinuitParameters(freezeParametersOfInterest);
+  ParameterBlockGuard blockGuard(block);
 
   nActiveParameters = getNActiveParameters();
 
@@ -799,7 +1004,9 @@ double Likelihood::maximize(bool freezeParametersOfInterest){
         <<endl;
     printCurrentParameters();
   }
+  minimizerAtMinimum = false;
   if(np==0){
+    block.invalidate();
     double e=computeTheLogLikelihood();
     if(getPrintLevel() < 2) {
       cout<<"Nothing to minimize, result:"<<formatF(e,19,8)<<endl;
@@ -808,48 +1015,69 @@ double Likelihood::maximize(bool freezeParametersOfInterest){
   }
 
  string m="Minuit2";
-  ROOT::Math::Minimizer* min = ROOT::Math::Factory::CreateMinimizer(m,"Migrad"); // ALE_TEST  -- before was Migrad
-  //ROOT::Math::Minimizer* min = ROOT::Math::Factory::CreateMinimizer(m,"Simplex"); // ALE_TEST  -- before was Migrad
-  if(min==NULL) {
-    cout<<"Can't load "<<m<<"; is it part of your current ROOT installation?"
-        <<endl;
-    return UNDEFINED;
+  // the minimizer is created and configured once, then reused by all the fits of this likelihood
+  if(minimizer==NULL) {
+    minimizer = ROOT::Math::Factory::CreateMinimizer(m,"Migrad"); // ALE_TEST  -- before was Migrad
+    //minimizer = ROOT::Math::Factory::CreateMinimizer(m,"Simplex"); // ALE_TEST  -- before was Migrad
+    if(minimizer==NULL) {
+      cout<<"Can't load "<<m<<"; is it part of your current ROOT installation?"
+          <<endl;
+      return UNDEFINED;
+    }
+    minimizer->SetMaxFunctionCalls(1000000); // for Minuit/Minuit2       //TEST_ALE was 100000
+    minimizer->SetMaxIterations(100000);  // for GSL                     //was           10000
+    // the objective is -log(L): one sigma is a change of 0.5, not 1 as for a chi2
+    minimizer->SetErrorDef(0.5);
+    // Migrad stops at edm < 0.002 * tolerance * ErrorDef, the tolerance is doubled
+    // to keep the convergence criterion of the former ErrorDef = 1, tolerance = 0.001
+    minimizer->SetTolerance(0.002); 					// was 0.01, then 0.001 with ErrorDef 1
+    minimizer->SetPrintLevel(-1);   // quiet
+  }
+  ROOT::Math::Minimizer* min = minimizer;
+
+  // drop the variables of the previous fit, Minuit2 would otherwise seed Migrad
+  // with the covariance left from it
+  min->Clear();
+
+  // start values, possibly seeded by the conditional fits already converged at nearby mu
+  vector<double> nominal(np);
+  for(int i=0;i<np;i++) nominal[i] = MinuitParameters[i]->getInitialValueInMinuitUnits();
+  vector<double> start(nominal);
+  bool seeded = freezeParametersOfInterest && warmStartMode != WARM_START_OFF && getWarmStartValues(start);
+
+  // use the analytic gradient if the likelihood provides one at the starting point,
+  // Minuit computes the derivatives numerically otherwise.
+  bool analytic = false;
+  if(withAnalyticGradient) {
+    mapGradientIndex();
+    vector<double> gradient(np);
+    setCurrentValuesInMinuitUnits(&start[0]);
+    analytic = computeTheGradient(&gradient[0]);
+    if(!analytic) Warning("maximize", "no analytic gradient for " + getName() + ", using numerical derivatives");
   }
 
   // set tolerance , etc...
-  ROOT::Math::Functor f(&LikelihoodEvaluate,np);
-  min->SetFunction(f);
-  min->SetMaxFunctionCalls(1000000); // for Minuit/Minuit2       //TEST_ALE was 100000
-  min->SetMaxIterations(100000);  // for GSL                     //was           10000
-  min->SetTolerance(0.001); 					// was 0.01
-  min->SetPrintLevel(-1);   // quiet
-  for(int i=0;i<np;i++){
-    LKParameter* par=MinuitParameters[i];
-   TString pnS= par->getName();
-    string pn = pnS.Data();
-    double v=par->getInitialValueInMinuitUnits();
-    double s = par->getStepInMinuitUnits();
-    //double s= par->getStepInMinuitUnits(); // don't ask why but the factor 100 is needed for better convergence
-    double vmi=par->getMinimumInMinuitUnits();
-    double vma=par->getMaximumInMinuitUnits();
-    if(getPrintLevel() < 1) {
-      double v0=par->getInitialValue();
-      double s0=par->getStep();
-      double vmi0=par->getMinimum();
-      double vma0=par->getMaximum();
-      cout<<"Setting parameter "<<(i+1)<<": "<<pn<<endl
-      <<"      Initial value  :"<<v0<<" min:"<<vmi0<<" max:"<<vma0<<" step:"<<s0
-      <<endl
-      <<"      In Minuit units:"<< v<<" min:"<<vmi <<" max:"<<vma <<" step:"<<s
-      <<endl;
-    }
-    min->SetLimitedVariable(i,pn.c_str(),v,s,vmi,vma);
-  }
+  ROOT::Math::Functor     f(this, &Likelihood::evaluateMinusLogLikelihood, np);
+  LikelihoodFunction      g(this, np);
+  if(analytic) min->SetFunction(g);
+  else         min->SetFunction(f);
+  setMinimizerVariables(start);
+
   // do the minimization
   min->Minimize();
 
+  if(seeded && min->Status() != 0) {
+    Warning("maximize", "warm started fit of " + getName() + " did not converge, fitting again from the initial values");
+    min->Clear();
+    setMinimizerVariables(nominal);
+    min->Minimize();
+  }
+
   // write the post fit value to LKparameter
   setCurrentValuesInMinuitUnits(min->X(),min->Errors());
+  block.invalidate();
+  minimizerAtMinimum = true;
+  if(freezeParametersOfInterest && warmStartMode != WARM_START_OFF && min->Status() == 0) storeWarmStartPoint();
   double ml= -1. * min->MinValue();
   if(getPrintLevel() < 2) {
     cout<<"ML "<<ml<<" achieved for "<<endl;
@@ -862,21 +1090,35 @@ double Likelihood::maximize(bool freezeParametersOfInterest){
 	LogD = ml;
    }
 
-  delete min;
   return ml;
 }
 
 
 
+bool Likelihood::computeHesse(){
+  if(minimizer == NULL || !minimizerAtMinimum) {
+    Warning("computeHesse", "no minimum from maximize() for " + getName());
+    return false;
+  }
+
+  bool ok = minimizer->Hesse();
+
+  // Hesse moves the parameters around the minimum, write it back with the new errors
+  setCurrentValuesInMinuitUnits(minimizer->X(), minimizer->Errors());
+  if(!ok) Warning("computeHesse", "Hesse failed for " + getName());
+  return ok;
+}
+
 double Likelihood::maximizeNumerically(int numberOfToys, bool freezeParametersOfInterest){
   // Actually this function minimize the -log(L) for consistency with what was written before.
 
-  double ML = VERY_LARGE; // maximum of the likelihood (we are minimizing actually)
+  minimizerAtMinimum = false;
 
-  currentLikelihood=this; // this is needed to feed the input parameter into the likelihood, it can be done better.
+  double ML = VERY_LARGE; // maximum of the likelihood (we are minimizing actually)
 
   //retrieving number of parameters
   int np=mapMinuitParameters(freezeParametersOfInterest);
+  ParameterBlockGuard blockGuard(block);
 
   nActiveParameters = getNActiveParameters();
 
@@ -892,6 +1134,7 @@ double Likelihood::maximizeNumerically(int numberOfToys, bool freezeParametersOf
   }
 
   if(np==0){
+    block.invalidate();
     double e=computeTheLogLikelihood();
     if(getPrintLevel() <2) {
       cout<<"Nothing to maximize, result:"<<formatF(e,19,8)<<endl;
@@ -901,7 +1144,7 @@ double Likelihood::maximizeNumerically(int numberOfToys, bool freezeParametersOf
 
   //function that evaluates log(L) for the set of parameter specified.
   //for usage see: https://root.cern.ch/how-implement-mathematical-function-inside-framework
-  ROOT::Math::Functor computeLL(&LikelihoodEvaluate,np);
+  ROOT::Math::Functor computeLL(this, &Likelihood::evaluateMinusLogLikelihood, np);
 
   // initializzation of the vector of values of NP to feed to Functor
   double bestGuess_val_np[np] ; 	//initial values
@@ -1027,6 +1270,7 @@ double Likelihood::maximizeNumerically(int numberOfToys, bool freezeParametersOf
   }
 
   //Setting post fit values
+  block.invalidate();
   for(int i=0; i < np; i++){
     LKParameter*   par  = MinuitParameters[i];
     //if(par->getType() == PARAMETER_OF_INTEREST) {
@@ -1065,6 +1309,8 @@ void ProfileLikelihood::printFlagsAndParameters(){
 
 void ProfileLikelihood::setup(){
   sigPar             = NULL;
+  sigmaAtQval        = UNDEFINED;
+  fitsAtQval         = 0;
 }
 
 
@@ -1123,13 +1369,8 @@ double ProfileLikelihood::getSigmaAtQval(double qval, bool forceMuhatComp){
 
   TGraph *g=getGraphAtQval(qval, forceMuhatComp);
   printf ("diff= got %d points \n",g->GetN());
-  TGraph *go=new TGraph(g->GetN(),g->GetY(), g->GetX());
-  double bestGuess=go->Eval(qval);
-  if (bestGuess<g->GetX()[0]) bestGuess=(-1);
-  if (g->GetN()==20) return bestGuess=(-2);
   delete g;
-  delete go;
-  return bestGuess;
+  return sigmaAtQval;
 }
 
 
@@ -1152,9 +1393,15 @@ TGraph * ProfileLikelihood::getGraphAtQval(double qval, bool forceMuhatComp){
 
   }
   double sigmin= getSigmaHat();
-  double sigma0,ll0;
+  // one sigma error on mu_hat from the unconditional fit (ErrorDef 0.5, see maximize()):
+  // asymptotically q = ((mu - mu_hat)/sigma)^2, so the first guess mu_hat + sigma*sqrt(qval) is
+  // already close to the crossing
+  double sigerr= getParameter(PAR_SIGMA)->getSigma();
   TGraph *g=new TGraph();
 
+  // the search steps around the limit, each conditional fit can start from its neighbours
+  clearWarmStartPoints();
+
     cout << "sigma min = " << sigmin << endl;
     cout << "sigma min = " << getParameterValue(PAR_SIGMA) << endl;
   //--- Qtilde set mu_hat to zero if mu_hat <0
@@ -1166,28 +1413,68 @@ TGraph * ProfileLikelihood::getGraphAtQval(double qval, bool forceMuhatComp){
 	cout << "Resetting simgma min to zero, sigma_min=" << sigmin << "   due to qtilde" << endl;
   }
 
-  double dstep=1;
-  sigma0=sigmin;   // Qtilde --> sigma0 > sigmamin
-  ll0=llmin;
-  double pdiff= -2.*(ll0-llmin)-qval;
-  int counter=0;
-  g->SetPoint(g->GetN(),sigma0, -2.*(ll0-ll0));
-  while (counter<20 && fabs(pdiff)>0.01) {
-    counter++;
-    sigma0=sigma0+dstep;
+  const int    maxFits = 20;
+  const double sigmax  = getParameter(PAR_SIGMA)->getMaximum();
+
+  // asymptotically sqrt(q) is linear in mu, find the root of sqrt(q) - sqrt(qval)
+  // between lo (below, sqrt(q)=0 at mu_hat) and hi (above)
+  double rqval = sqrt(qval);
+  double lo = sigmin, flo = -rqval;
+  double hi = UNDEFINED, fhi = 0.;
+  int    side = 0;   // Illinois: last end point kept, its value is halved when kept twice
+
+  g->SetPoint(g->GetN(), sigmin, 0.);
+  fitsAtQval  = 0;
+  sigmaAtQval = -2;
+
+  double sigma0 = (sigerr > 0. && sigerr != UNDEFINED) ? sigmin + sigerr * rqval : sigmin + 1.;
+
+  while (fitsAtQval < maxFits) {
+    fitsAtQval++;
     resetParameters();
 	  setParameterValue(PAR_SIGMA, sigma0 );
 
-	  ll0       =  maximize(true);
-	  printCurrentParameters();
-
-	  g->SetPoint(g->GetN(),sigma0,-2.*(ll0-llmin));
-	  double diff= -2.*(ll0-llmin)-qval;
-	  if (pdiff*diff<0) dstep= -1.*dstep*0.5;
-	  pdiff=diff;
-	  printf (" \t  at: %f (min %f)  q_lim=%f  ll0=%f  qval=%f diff=%f next-step=%f \n",sigma0,sigmin, qval, ll0,-2*(ll0-llmin), pdiff, dstep);
+	  double ll0  =  maximize(true);
+	  if(getPrintLevel() < 1) printCurrentParameters();
+
+	  double q0 = -2.*(ll0-llmin);
+	  g->SetPoint(g->GetN(), sigma0, q0);
+	  printf (" \t  at: %f (min %f)  q_lim=%f  ll0=%f  qval=%f diff=%f fits=%d \n",sigma0,sigmin, qval, ll0, q0, q0-qval, fitsAtQval);
+
+	  if (fabs(q0-qval) < 0.01) { sigmaAtQval = sigma0; break; }
+
+	  double f0 = sqrt(TMath::Max(q0, 0.)) - rqval;
+
+	  if (f0 < 0.) {
+	    lo = sigma0; flo = f0;
+	    if (side == -1) fhi /= 2.;
+	    side = -1;
+	  }
+	  else {
+	    hi = sigma0; fhi = f0;
+	    if (side == 1) flo /= 2.;
+	    side = 1;
+	  }
+
+	  if (hi == UNDEFINED) {
+	    // not bracketed yet, extrapolate the slope of sqrt(q) with some overshoot
+	    double slope = (sigma0 > sigmin) ? (f0 + rqval) / (sigma0 - sigmin) : 0.;
+	    double next  = (slope > 0.) ? sigmin + 1.2 * rqval / slope : sigmin + 2. * (sigma0 - sigmin + 1.);
+	    if (next <= sigma0) next = sigma0 + (sigma0 - sigmin + 1.);
+	    if (sigma0 >= sigmax) break;
+	    sigma0 = TMath::Min(next, sigmax);
+	  }
+	  else {
+	    sigma0 = hi - fhi * (hi - lo) / (fhi - flo);
+	    if (hi - lo < 1e-6 * TMath::Max(1., fabs(hi))) { sigmaAtQval = sigma0; break; }
+	  }
 	}
 
+  g->Sort();
+
+  if(getPrintLevel() < 2) {
+    cout << "ProfileLikelihood::getGraphAtQval - mu at q=" << qval << " : " << sigmaAtQval << " after " << fitsAtQval << " conditional fits" << endl;
+  }
 
   return g;
 
@@ -1210,6 +1497,7 @@ TGraph* ProfileLikelihood::getGraphOfLogLikelihood( int n_points){
 
   double ll_Denominator = maximize(false);  // unconditional fit!!!
 //  double ll_Denominator = maximizeNumerically(200,false);  // unconditional fit!!!
+  clearWarmStartPoints();
   double post_fit_sigma = par->getCurrentValue();
 
   cout << "min:  " << min << "   Max:  " << max << "   PostFit:   " << post_fit_sigma  << "  LL max " << ll_Denominator<< endl;
@@ -1260,6 +1548,7 @@ TGraph* ProfileLikelihood::getLikelihoodScanOfParameter( int n_points, LKParamet
 
   sig->setCurrentValue(mu); // conditional fit set to mu... Default is zero signal!
 
+  clearWarmStartPoints();
   double ll_Denominator = maximize(true); // conditional best fit
 
   int save_para_type = par->getType();
@@ -1317,7 +1606,7 @@ vector <TGraph*> ProfileLikelihood::getGraphOfParameters( int n_points){
 
   double step = (max - min) / ((double) n);
 
-
+  clearWarmStartPoints();
   for(int i=0;i<n;i++){
     resetParameters();
 
@@ -1344,6 +1633,8 @@ CombinedProfileLikelihood::CombinedProfileLikelihood(TString n)
                    : ProfileLikelihood(n) {
   combinedMode=false;
   nCommon=0;
+  pool=NULL;
+  incremental=false;
   setExperiment(ALL);
 }
 
@@ -1356,6 +1647,31 @@ CombinedProfileLikelihood::~CombinedProfileLikelihood(){
     pl->clearTheParameters();
   }
 
+  delete pool;
+}
+
+void CombinedProfileLikelihood::setParallelExperiments(int nThreads){
+  delete pool;
+  pool = NULL;
+
+  if(nThreads > 1) {
+     // the experiments still create and read ROOT objects (histos, files) on the workers
+     ROOT::EnableThreadSafety();
+     pool = new workerPool(nThreads);
+  }
+}
+
+vector<unsigned long> CombinedProfileLikelihood::getDataVersions(){
+  vector<unsigned long> versions;
+  TRAVERSE_EXPERIMENTS(it) {
+     vector<unsigned long> v = it->second->getDataVersions();
+     versions.insert(versions.end(), v.begin(), v.end());
+  }
+  return versions;
+}
+
+void CombinedProfileLikelihood::prepareConcurrentEvaluation(){
+  TRAVERSE_EXPERIMENTS(it) it->second->prepareConcurrentEvaluation();
 }
 
 ProfileLikelihood* CombinedProfileLikelihood::getProfile(int ex){
@@ -1389,6 +1705,8 @@ void   CombinedProfileLikelihood::combine(ProfileLikelihood* pl) {
 bool CombinedProfileLikelihood::initialize(){
  Info("CombinedProfileLikelihood", "Building up combined PL " + getName() );
 
+  clearCachedLikelihoods();
+
   // PROPOSAL: to combine parameters use the pointer value to check if is the same parameter.
 
   // first common parameters
@@ -1521,13 +1839,47 @@ double CombinedProfileLikelihood::computeTheLogLikelihood(){
   double ll=0;
 
   if(exps.size() > 0) {
-     TRAVERSE_EXPERIMENTS(it) {
+     vector<ProfileLikelihood*> pls;
+     vector<int>                ids;
+     TRAVERSE_EXPERIMENTS(it) { pls.push_back(it->second); ids.push_back(it->first); }
+
+     // in incremental mode only the experiments whose parameters moved are recomputed
+     vector<double>           partials(pls.size());
+     vector<DependencyValues> values(pls.size());
+     vector<int>              toCompute;
+     for(unsigned int i=0; i < pls.size(); i++) {
+        if(incremental) {
+           values[i] = getDependencyValues(pls[i]);
+           map<int,DependencyValues>::iterator cached = cachedValues.find(ids[i]);
+           if(cached != cachedValues.end() && cached->second == values[i]) {
+              partials[i] = cachedLL[ids[i]];
+              continue;
+           }
+        }
+        toCompute.push_back(i);
+     }
+
+     // the experiments share only parameter values, which are just read here. Anything
+     // touching files or gDirectory is done first, on this thread (cheap once done).
+     if(pool != NULL) prepareConcurrentEvaluation();
 
-        ProfileLikelihood* pl=it->second;
-        double partial = pl->computeTheLogLikelihood();
+     if(pool != NULL) pool->run(toCompute.size(), [&](int c){ partials[toCompute[c]] = pls[toCompute[c]]->computeTheLogLikelihood(); });
+     else             for(unsigned int c=0; c < toCompute.size(); c++) partials[toCompute[c]] = pls[toCompute[c]]->computeTheLogLikelihood();
+
+     if(incremental) {
+        for(unsigned int c=0; c < toCompute.size(); c++) {
+           cachedValues[ids[toCompute[c]]] = values[toCompute[c]];
+           cachedLL[ids[toCompute[c]]]     = partials[toCompute[c]];
+        }
+     }
+
+     for(unsigned int i=0; i < pls.size(); i++) {
+
+        ProfileLikelihood* pl=pls[i];
+        double partial = partials[i];
         ll += partial;
 
-        Debug("computeTheLogLikelihood", TString::Format("LL %s = %f", pl->getName().Data(), partial) );
+        XE_DEBUG("computeTheLogLikelihood", TString::Format("LL %s = %f", pl->getName().Data(), partial) );
         if(getPrintLevel() == DEBUG) pl->printCurrentParameters();
 
       }
@@ -1538,6 +1890,34 @@ double CombinedProfileLikelihood::computeTheLogLikelihood(){
 
   return ll;
 }
+
+CombinedProfileLikelihood::DependencyValues CombinedProfileLikelihood::getDependencyValues(ProfileLikelihood *pl){
+
+  // correlated parameters appear here as the sub parameters of the CombinedParameter
+  DependencyValues values;
+  map<int,LKParameter*> *params = pl->getParameters();
+  for(ParameterIterator ip=params->begin(); ip!=params->end(); ip++)
+     values.push_back(make_pair(ip->second, ip->second->getCurrentValue()));
+
+  values.push_back(make_pair((LKParameter*) NULL, pl->getSignalMultiplier()));
+
+  // data changed on the experiment itself (setDataHandler, setTreeIndex...) must not reuse its LL
+  vector<unsigned long> versions = pl->getDataVersions();
+  for(unsigned int i=0; i < versions.size(); i++)
+     values.push_back(make_pair((LKParameter*) NULL, (double) versions[i]));
+
+  return values;
+}
+
+bool CombinedProfileLikelihood::computeTheLogLikelihoodGradient(double *gradient, GradientIndex &index){
+
+  // the sub likelihoods share the index: correlated parameters sum up in the same slot
+  TRAVERSE_EXPERIMENTS(it) {
+     if(!it->second->computeTheLogLikelihoodGradient(gradient, index)) return false;
+  }
+
+  return true;
+}
 /*
 void CombinedProfileLikelihood::setWimpMass(double mass){
   if(printLevel>0) {
@@ -1552,6 +1932,7 @@ void CombinedProfileLikelihood::setWimpMass(double mass){
 */
 void CombinedProfileLikelihood::setData(int dataType){
 
+  clearCachedLikelihoods();
   TRAVERSE_EXPERIMENTS(it) {
     ProfileLikelihood* pl=it->second;
     pl->setData(dataType);
@@ -1568,6 +1949,7 @@ void CombinedProfileLikelihood::printEventSummary(bool isForWiki){
 
 void CombinedProfileLikelihood::generateAsimov(double mu_prime){
 
+  clearCachedLikelihoods();
   TRAVERSE_EXPERIMENTS(it) {
     ProfileLikelihood* pl=it->second;
     pl->generateAsimov(mu_prime);
@@ -1576,6 +1958,7 @@ void CombinedProfileLikelihood::generateAsimov(double mu_prime){
 
 void CombinedProfileLikelihood::generateToyDataset(double seed, double mu_prime){
 
+  clearCachedLikelihoods();
   TRAVERSE_EXPERIMENTS(it) {
     ProfileLikelihood* pl=it->second;
     pl->generateToyDataset(seed, mu_prime);
@@ -1724,6 +2107,7 @@ vector<double> CombinedProfileLikelihood::getTrueParams()   {
 
 void CombinedProfileLikelihood::setTreeIndex( int index ){
 
+  clearCachedLikelihoods();
   TRAVERSE_EXPERIMENTS(it) {
     ProfileLikelihood* pl=it->second;
     pl->setTreeIndex(index);
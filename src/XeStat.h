@@ -11,6 +11,7 @@
 #include "XeUtils.h"
 
 #include "Math/Functor.h"
+#include "Math/IFunction.h"
 
 #include <iomanip>
 #include <sstream>
@@ -105,6 +106,10 @@ enum   ciMode        { CI_UP
                      } ;
 
 enum sigmaModes   { ESTIMATED, UPPER_LIMIT };
+enum warmStartModes { WARM_START_OFF       // conditional fits start from the initial values
+                    , WARM_START_NEAREST   // start from the converged fit at the nearest mu
+                    , WARM_START_LINEAR    // extrapolate linearly from the two nearest converged fits
+                    } ;
 enum sigmaUnits   { SIGMA_UNIT     , EVENT_UNIT };
 
 static const  double DEFAULT_CL                    =            0.9 ;
@@ -381,9 +386,14 @@ class LKParameter :  public XeStat {
 
     double  getInitialSigma() { return initialSigma;};
 
+    double  getMinuitUnit() { return MinuitUnit;};
+
     //return the gaussian constraint on the t-value
     double getLLGausConstraint();
 
+    //return the derivative of the gaussian constraint wrt the t-value
+    double getLLGausConstraintDerivative();
+
     /* -------------------------------------------------------------
      *                     Advanced methods
      * ------------------------------------------------------------*/
@@ -543,6 +553,59 @@ class TEfficiencyParameter : public LKParameter {
 } ;
 
 
+//! maps a parameter to its position in the gradient handed to Minuit
+typedef map<LKParameter*,int> GradientIndex;
+
+/**
+ * \class ParameterBlock
+ * \brief dense copy of the parameters of a likelihood, read by the evaluation during a fit.
+ *
+ * Built by mapMinuitParameters() in the order of the parameter map and valid until the end
+ * of the fit: in between only the Minuit parameters move, and setCurrentValuesInMinuitUnits()
+ * writes them here as well as to the LKParameter (which the pdf components read).
+ */
+class ParameterBlock {
+
+  public:
+
+    ParameterBlock() : valid(false) {};
+
+    void   build(map<int,LKParameter*> &parameters, vector<LKParameter*> &minuitParameters);
+    void   invalidate()    { valid = false; };
+    bool   isValid() const { return valid; };
+    bool   hasNaN()  const;
+
+    vector<LKParameter*>  params;
+    vector<double>        values;
+    vector<double>        t0;
+    vector<int>           types;
+    vector<int>           minuitSlot;   //! position in values of each Minuit parameter
+    vector<double>        minuitUnits;  //! MinuitUnit of each Minuit parameter
+
+  private:
+
+    bool                  valid;
+};
+
+/**
+ * \class ParameterBlockGuard
+ * \brief invalidates a ParameterBlock when leaving the scope of a fit, also when the fit throws.
+ */
+class ParameterBlockGuard {
+
+  public:
+
+    ParameterBlockGuard(ParameterBlock &b) : block(b) {};
+    ~ParameterBlockGuard() { block.invalidate(); };
+
+  private:
+
+    ParameterBlockGuard(const ParameterBlockGuard &);
+    ParameterBlockGuard& operator=(const ParameterBlockGuard &);
+
+    ParameterBlock       &block;
+};
+
  /**
      * A likelihood object, consisting of parameters.
      * This is a virtual class
@@ -563,6 +626,22 @@ class Likelihood :  public XeStat {
 
      virtual  double computeTheLogLikelihood()=0;
               double computeTheConstraint();
+
+ /**
+     * Adds the derivatives of the log likelihood wrt the parameter values to gradient.
+     * The derivative wrt a parameter p goes to gradient[index[p]], parameters
+     * not in index are skipped.
+     * @return  false if the likelihood has no analytic gradient, in which case
+     *          maximize() falls back to numerical derivatives.
+ */
+     virtual  bool   computeTheLogLikelihoodGradient(double *gradient, GradientIndex &index) { return false; };
+              void   computeTheConstraintGradient(double *gradient, GradientIndex &index);
+
+ /**
+     * Reads from file and builds everything computeTheLogLikelihood() would otherwise set up
+     * on first use, so that several likelihoods can then be evaluated on concurrent threads.
+ */
+     virtual  void   prepareConcurrentEvaluation() {};
      virtual ~Likelihood();
 
 /**
@@ -654,6 +733,29 @@ class Likelihood :  public XeStat {
      double   maximize(bool freezeParametersOfInterest);
      double   maximizeNumerically(int numberOfToys , bool freezeParametersOfInterest);
      void     setSeed(double Inputseed) {seed = Inputseed;};
+
+ /**
+     * Let Minuit use the analytic gradient of the likelihood, when the likelihood
+     * provides one (see computeTheLogLikelihoodGradient), default is false.
+ */
+     void     setAnalyticGradient(bool b) {withAnalyticGradient = b;};
+
+ /**
+     * Start each conditional fit from the converged conditional fits at nearby mu
+     * (WARM_START_NEAREST, WARM_START_LINEAR) instead of the initial values, default
+     * is WARM_START_OFF. A warm started fit that does not converge is redone from the
+     * initial values. The converged points refer to the current data: the scans clear
+     * them when they start, call clearWarmStartPoints() if you change the data yourself.
+ */
+     void     setWarmStart(int mode) {warmStartMode = mode; clearWarmStartPoints();};
+     int      getWarmStart()          {return warmStartMode;};
+
+ /**
+     * Runs Hesse at the minimum found by the last maximize() and writes the errors to the
+     * parameters (see LKParameter::getSigma). Returns false if there is no such minimum or Hesse fails.
+ */
+     bool     computeHesse();
+     void     clearWarmStartPoints()  {warmStartPoints.clear();};
     /* -------------------------------------------------------------
      *                     Advanced methods
      * ------------------------------------------------------------*/
@@ -697,6 +799,13 @@ class Likelihood :  public XeStat {
      bool     checkConsistency();
      bool     inCombinedMode();
      int      mapMinuitParameters(bool freezeParametersOfInterest);
+     void     mapGradientIndex();
+     bool     computeTheGradient(double *gradient);
+     void     computeNumericalGradient(const double *values, double *gradient);
+     //! -log(L) with constraints at values in Minuit units, this is what Minuit minimizes.
+     double   evaluateMinusLogLikelihood(const double *values);
+     //! gradient of evaluateMinusLogLikelihood(), numerical where the analytic one is refused.
+     void     evaluateMinusLogLikelihoodGradient(const double *values, double *gradient);
      int      getNParametersForChi2();
      void     forceNParametersOfInterest(int nF);
      void     clearTheParameters();
@@ -716,6 +825,17 @@ class Likelihood :  public XeStat {
      bool                  combinedMode;
      vector<LKParameter*>  MinuitParameters;
      map<int,LKParameter*> parameters;
+     bool                  withAnalyticGradient;
+     GradientIndex         gradientIndex;    /*!< Minuit index of each parameter, correlated ones included */
+     ParameterBlock        block;            /*!< dense parameter values, valid during maximize() */
+     ROOT::Math::Minimizer *minimizer;       /*!< Minuit2 instance kept for all the fits, created by the first maximize() */
+     int                   warmStartMode;
+     bool                  minimizerAtMinimum;  /*!< the minimizer holds the minimum of the last maximize() */
+     map<double, map<LKParameter*,double> > warmStartPoints;  /*!< post fit values of the converged conditional fits, per mu */
+
+     void                  setMinimizerVariables(const vector<double> &start);
+     bool                  getWarmStartValues(vector<double> &start);
+     void                  storeWarmStartPoint();
 
      double       sigmaHat; /*!< Saved value of estimated sigma */
 
@@ -733,6 +853,36 @@ typedef map<int,LKParameter*>::iterator ParameterIterator;
   for(ParameterIterator it=parameters.begin(); it!=parameters.end(); it++)
 
 
+/**
+ * \class LikelihoodFunction
+ * \brief -log(L) of a Likelihood with its gradient, in Minuit units.
+ *
+ * Each instance is bound to its own likelihood, no global state is involved,
+ * so independent likelihoods can be minimized at the same time in different threads.
+ */
+class LikelihoodFunction : public ROOT::Math::IMultiGradFunction {
+
+  public:
+
+     LikelihoodFunction(Likelihood *lk, unsigned int n) : likelihood(lk), nDim(n) {};
+
+     unsigned int                    NDim()  const { return nDim; };
+
+     ROOT::Math::IMultiGradFunction* Clone() const { return new LikelihoodFunction(likelihood, nDim); };
+
+     void   Gradient(const double *values, double *gradient) const;
+
+  private:
+
+     double DoEval(const double *values) const;
+
+     double DoDerivative(const double *values, unsigned int coordinate) const;
+
+     Likelihood    *likelihood;
+     unsigned int   nDim;
+};
+
+
 
 
 /**
@@ -786,11 +936,15 @@ class ProfileLikelihood : public Likelihood {
   * @param n_points is the number of scan points for which the likelihood is maximized
 */
     TGraph* getGraphOfLogLikelihood(int n_points);
-    //produce a graph of scan qValues scanning on mu, if forceMuhatComp=true then
-    //will recompute the minimum even if it was already computed and stored.
+    //produce a graph of the qValues computed while searching the mu > mu_hat where q = qval,
+    //if forceMuhatComp=true then will recompute the minimum even if it was already computed and stored.
+    //The search is a bracketed root finding (Illinois) on sqrt(q(mu)), seeded by the
+    //asymptotic guess mu_hat + sigma*sqrt(qval), every conditional fit is a point of the graph.
     TGraph* getGraphAtQval(double qval, bool forceMuhatComp=true);
     double getSigmaAtQval(double qval, bool forceMuhatComp=true);
     double returnLimitHagar( double cl, bool forceMuhatComp=true);
+    //number of conditional fits used by the last getGraphAtQval
+    int    getNumberOfFitsAtQval() {return fitsAtQval;};
 
     //double getMaximum()
 /**
@@ -823,6 +977,9 @@ class ProfileLikelihood : public Likelihood {
 
   virtual vector<double> getTrueParams() =0;
 
+  //! versions of the datasets the likelihood is evaluated on (see dataHandler::getVersion), they change with the events
+  virtual vector<unsigned long> getDataVersions() { return vector<unsigned long>(); };
+
   virtual double getSafeguardValue()=0;
 
   protected :
@@ -834,6 +991,10 @@ class ProfileLikelihood : public Likelihood {
 
     LKParameter *sigPar;  /*!< Pointer to main parameter of interest */
 
+    double       sigmaAtQval; /*!< mu found by the last getGraphAtQval, -2 if not converged */
+
+    int          fitsAtQval;  /*!< conditional fits used by the last getGraphAtQval */
+
 
 } ;
 
@@ -853,6 +1014,11 @@ class CombinedProfileLikelihood : public ProfileLikelihood {
           ~CombinedProfileLikelihood();
     void   combine(ProfileLikelihood* pl);
     double computeTheLogLikelihood();
+    bool   computeTheLogLikelihoodGradient(double *gradient, GradientIndex &index);
+
+    void   prepareConcurrentEvaluation();
+
+    vector<unsigned long> getDataVersions();
 
     /* -------------------------------------------------------------
      *                     Advanced methods
@@ -860,6 +1026,22 @@ class CombinedProfileLikelihood : public ProfileLikelihood {
 
     ProfileLikelihood* getProfile(int experiment);
 
+ /**
+     * Evaluate the experiments concurrently on a pool of nThreads threads, kept for
+     * all the following evaluations. The partial LL are summed in experiment order,
+     * so the result does not depend on the scheduling. nThreads <= 1 goes back to serial.
+ */
+    void               setParallelExperiments(int nThreads);
+
+ /**
+     * Recompute only the experiments whose parameter values (or signal multiplier) changed
+     * since their last evaluation, the others contribute their cached LL. Default is false.
+     * The cache is dropped when data change through this class, call clearCachedLikelihoods()
+     * if the data of an experiment are changed directly on it.
+ */
+    void               setIncrementalEvaluation(bool b) { incremental = b; clearCachedLikelihoods(); };
+    void               clearCachedLikelihoods()         { cachedValues.clear(); cachedLL.clear(); };
+
  /**
      * print All flags and parameters
  */
@@ -907,6 +1089,16 @@ class CombinedProfileLikelihood : public ProfileLikelihood {
     map<int,ProfileLikelihood* > exps;
     int                          nCommon;
     double                       sigToEvents;
+    workerPool                  *pool;         /*!< evaluates the experiments concurrently, NULL for serial */
+
+    //! parameter values (and signal multiplier and data versions, with NULL parameter) an experiment depends on
+    typedef vector<pair<LKParameter*,double> > DependencyValues;
+
+    DependencyValues   getDependencyValues(ProfileLikelihood *pl);
+
+    bool                         incremental;
+    map<int,DependencyValues>    cachedValues;  /*!< values at which cachedLL was computed */
+    map<int,double>              cachedLL;
 
 
 };
@@ -2,7 +2,7 @@
 
 //! global print level by default set to all.
 //! 0 =  Debug-print all, 1 = Info + Warning + Error, 2 = Warning +  Error, 3 = Only error
-int errorHandler::globalPrintLevel = 1;
+std::atomic<int> errorHandler::globalPrintLevel(1);
 
 errorHandler::errorHandler(TString name) : className(name) { 
 
@@ -154,3 +154,66 @@ TString printTools::rightJustify(TString s, int w, bool trm){
 
 
 TString printTools::doOrDont(bool b) {return b? "":"don't";}
+
+
+
+workerPool::workerPool(int nThreads) : nTasks(0), next(0), pending(0), generation(0), stop(false) {
+
+    for(int t = 1; t < nThreads; t++) workers.push_back(thread(&workerPool::loop, this));
+}
+
+workerPool::~workerPool(){
+
+    {
+        std::unique_lock<std::mutex> lock(guard);
+        stop = true;
+    }
+    wake.notify_all();
+    for(unsigned int t = 0; t < workers.size(); t++) workers[t].join();
+}
+
+void workerPool::run(int n, std::function<void(int)> task){
+
+    std::unique_lock<std::mutex> lock(guard);
+    job      = task;
+    nTasks   = n;
+    next     = 0;
+    pending  = n;
+    failure  = nullptr;
+    generation++;
+    wake.notify_all();
+
+    work(lock);
+    done.wait(lock, [this]{ return pending == 0; });
+
+    job = nullptr;
+    if(failure) std::rethrow_exception(failure);
+}
+
+void workerPool::work(std::unique_lock<std::mutex> &lock){
+
+    while(next < nTasks){
+        int i = next++;
+        lock.unlock();
+
+        std::exception_ptr error;
+        try { job(i); }
+        catch(...) { error = std::current_exception(); }
+
+        lock.lock();
+        if(error && !failure) failure = error;
+        if(--pending == 0) done.notify_all();
+    }
+}
+
+void workerPool::loop(){
+
+    std::unique_lock<std::mutex> lock(guard);
+    long seen = generation;
+    while(true){
+        wake.wait(lock, [&]{ return stop || generation != seen; });
+        if(stop) return;
+        seen = generation;
+        work(lock);
+    }
+}
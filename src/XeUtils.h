@@ -3,6 +3,15 @@
 
 #include "TString.h"
 #include <iostream>
+#include <vector>
+#include <algorithm>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <exception>
+#include <deque>
 
 static const int ERROR   = 3;
 static const int WARNING = 2;
@@ -70,17 +79,29 @@ class errorHandler {
     
     //! \brief Return the current print level for this instance. 
     //! remind that if you set with setPrintLevel this will override the global print level.
-    int  getPrintLevel()  {return (localPrintLevel >= 0 ? localPrintLevel : globalPrintLevel) ;};
+    int  getPrintLevel()  {return (localPrintLevel >= 0 ? localPrintLevel : globalPrintLevel.load()) ;};
 
    
     int localPrintLevel;              /*!< local print level for this instance modify it with setPrintLevel. */
     
-    static int globalPrintLevel;      /*<! global print level of all objects, modify this with errorHandler::globalPrintLevel.
-                                       and you'll modify all. */
+    static std::atomic<int> globalPrintLevel;  /*<! global print level of all objects, modify this with errorHandler::globalPrintLevel.
+                                       and you'll modify all. Atomic, as it is read by fits running in threads. */
     
     TString className;	
 };
 
+/**
+ * \brief Debug() of an errorHandler that builds its message only if it is going to be printed.
+ *
+ * Meant for the code run at each likelihood evaluation: the message arguments are not evaluated
+ * unless the print level is Debug. Compiling with -DXE_NO_DEBUG removes these prints altogether.
+ */
+#ifdef XE_NO_DEBUG
+#define XE_DEBUG(functionName, message) do { } while(0)
+#else
+#define XE_DEBUG(functionName, message) do { if(getPrintLevel() < 1) Debug(functionName, message); } while(0)
+#endif
+
 /**
  * \class printTools
  * \brief printing helpers, probably you wont use this class
@@ -117,4 +138,174 @@ public:
 
 
 
+/**
+ * \class kahanSum
+ * \brief compensated summation, carries the rounding error of each addition along.
+ */
+class kahanSum {
+
+public:
+
+    kahanSum() : sum(0.), compensation(0.) {};
+
+    void   add(double value) {
+        double y = value - compensation;
+        double t = sum + y;
+        compensation = (t - sum) - y;
+        sum = t;
+    };
+
+    double get() const { return sum; };
+
+private:
+
+    double sum;
+    double compensation;
+};
+
+/**
+ * \class workerPool
+ * \brief a fixed set of threads kept alive between calls, to run many short parallel loops.
+ */
+class workerPool {
+
+public:
+
+    //! \brief starts nThreads - 1 workers, the thread calling run() is the last one.
+    workerPool(int nThreads);
+    ~workerPool();
+
+    //! \brief runs task(i) for i in [0, n) and returns when all are done.
+    /**
+     * Tasks are handed out in index order to whichever thread is free: task(i) must only
+     * write its own results. An exception thrown by a task is rethrown here.
+     */
+    void run(int n, std::function<void(int)> task);
+
+    int  getNThreads() const { return workers.size() + 1; };
+
+private:
+
+    void loop();
+
+    //! \brief takes tasks until none is left, called with the lock held.
+    void work(std::unique_lock<std::mutex> &lock);
+
+    vector<thread>            workers;
+    std::mutex                guard;
+    std::condition_variable   wake;
+    std::condition_variable   done;
+    std::function<void(int)>  job;
+    std::exception_ptr        failure;
+    int                       nTasks;
+    int                       next;
+    int                       pending;
+    long                      generation;   //! counts the calls to run(), wakes up the workers
+    bool                      stop;
+};
+
+
+
+/**
+ * \class parallelSum
+ * \brief deterministic sum over a range of indices, optionally split over the threads of a workerPool.
+ *
+ * The range is cut in chunks of fixed size whatever the number of threads, each chunk
+ * has its own kahanSum and the chunk sums are added in chunk order: the result is
+ * bit-identical for any number of threads.
+ */
+class parallelSum {
+
+public:
+
+    //! small enough that a calibration set of a few thousand events still spreads over the threads
+    static const Long64_t chunkSize = 256;
+
+    //! \brief sums over [0, n), body(begin, end, sum) adds the terms of [begin, end) to the kahanSum sum.
+    /**
+     * body returns false to reject the whole sum (e.g. an unphysical term), run() then returns false.
+     * With a pool body is called concurrently on different chunks, it must only read shared data.
+     * pool NULL sums on the calling thread.
+     */
+    template <class Body>
+    static bool run(Long64_t n, workerPool *pool, Body body, double &result){
+
+        Long64_t nChunks = (n + chunkSize - 1) / chunkSize;
+
+        vector<kahanSum> partial(nChunks);
+        vector<char>     valid(nChunks, 1);
+
+        auto chunk = [&](int c){
+            valid[c] = body(c * chunkSize, min(n, (c + 1) * chunkSize), partial[c]);
+        };
+
+        if(pool != NULL && nChunks > 1) pool->run(nChunks, chunk);
+        else for(Long64_t c = 0; c < nChunks; c++) chunk(c);
+
+        kahanSum total;
+        for(Long64_t c = 0; c < nChunks; c++){
+            if(!valid[c]) return false;
+            total.add(partial[c].get());
+        }
+
+        result = total.get();
+        return true;
+    };
+};
+
+
+
+/**
+ * \class boundedQueue
+ * \brief a FIFO of at most capacity items shared by producer and consumer threads.
+ *
+ * push() waits while the queue is full, pop() while it is empty. After close() push() refuses
+ * new items and pop() returns false once the queue is drained.
+ */
+template <class T> class boundedQueue {
+
+public:
+
+    boundedQueue(unsigned int capacity) : capacity(capacity > 0 ? capacity : 1), closed(false) {};
+
+    //! \brief appends item, returns false (item not taken) if the queue is closed.
+    bool push(T item){
+        std::unique_lock<std::mutex> lock(guard);
+        notFull.wait(lock, [this]{ return closed || items.size() < capacity; });
+        if(closed) return false;
+        items.push_back(item);
+        notEmpty.notify_one();
+        return true;
+    };
+
+    //! \brief takes the oldest item, returns false if the queue is closed and empty.
+    bool pop(T &item){
+        std::unique_lock<std::mutex> lock(guard);
+        notEmpty.wait(lock, [this]{ return closed || !items.empty(); });
+        if(items.empty()) return false;
+        item = items.front();
+        items.pop_front();
+        notFull.notify_one();
+        return true;
+    };
+
+    void close(){
+        std::unique_lock<std::mutex> lock(guard);
+        closed = true;
+        notFull.notify_all();
+        notEmpty.notify_all();
+    };
+
+private:
+
+    std::deque<T>             items;
+    unsigned int              capacity;
+    bool                      closed;
+    std::mutex                guard;
+    std::condition_variable   notFull;
+    std::condition_variable   notEmpty;
+};
+
+
+
 #endif
\ No newline at end of file
@@ -1,11 +1,18 @@
 #include "dataHandler.h"
 
+std::atomic<unsigned long> dataHandler::lastVersion(0);
+
 dataHandler::dataHandler(TString name) : errorHandler("dataHandler"), Name(name){
 
+	clearBinCache();
+
+	storeFile    = NULL;
+	storeEvents  = NULL;
+	trueParamsLoaded = false;
+
 	DMdata = NULL;
 	file = NULL;
 	sumOfWeights=0;
-	gs1s2w=0;
 	
 	
 	s1 = 0.;
@@ -20,6 +27,12 @@ dataHandler::dataHandler(TString name) : errorHandler("dataHandler"), Name(name)
 
 dataHandler::dataHandler(TString name, TH2F *h2pdf, int N) : errorHandler("dataHandler"), Name(name){
 
+	clearBinCache();
+
+	storeFile    = NULL;
+	storeEvents  = NULL;
+	trueParamsLoaded = false;
+
       	DMdata = NULL;
 
 
@@ -29,7 +42,7 @@ dataHandler::dataHandler(TString name, TH2F *h2pdf, int N) : errorHandler("dataH
 	s1 = 0.;
 	s2 = 0.;
 	weight = 1.;
-	gs1s2w=new TGraph2D();
+	file = NULL;
 	sumOfWeights=0;
 	generateDataSet(h2pdf,N);
 }
@@ -37,6 +50,12 @@ dataHandler::dataHandler(TString name, TH2F *h2pdf, int N) : errorHandler("dataH
 
 dataHandler::dataHandler(TString name, TH2F *h2pdf) : errorHandler("dataHandler"), Name(name){
 
+	clearBinCache();
+
+	storeFile    = NULL;
+	storeEvents  = NULL;
+	trueParamsLoaded = false;
+
   DMdata = NULL;
 
   FirstVarName   = "cs1";  //default var in data
@@ -46,8 +65,8 @@ dataHandler::dataHandler(TString name, TH2F *h2pdf) : errorHandler("dataHandler"
   s1 = 0.;
   s2 = 0.;
   weight = 1.;
+  file = NULL;
   
-  gs1s2w=new TGraph2D();
   dataType = ASIMOV_DATA; 
 
   generateAsimov(h2pdf);
@@ -57,6 +76,12 @@ dataHandler::dataHandler(TString name, TH2F *h2pdf) : errorHandler("dataHandler"
 
 dataHandler::dataHandler(TString name, TString fileName, TString dmTree) : errorHandler("dataHandler"), Name(name){
 
+	clearBinCache();
+
+	storeFile    = NULL;
+	storeEvents  = NULL;
+	trueParamsLoaded = false;
+
 	file = TFile::Open(fileName);
 
 	if(file == NULL)
@@ -77,18 +102,10 @@ dataHandler::dataHandler(TString name, TString fileName, TString dmTree) : error
 	s2 = 0.;
 	weight = 1.;
 	sumOfWeights=0;
-	DMdata->SetBranchAddress(FirstVarName,&s1);
-	DMdata->SetBranchAddress(SecondVarName,&s2);
 	
 	dataType = DM_DATA;
 
-	gs1s2w=new TGraph2D();
-	for (int i=0; i< DMdata->GetEntries(); i++) {
-	   weight = 1.;
-	   DMdata->GetEntry(i);
-	   gs1s2w->SetPoint(gs1s2w->GetN(),s1,s2,weight);
-	   sumOfWeights+=weight;
-	}
+	readEvents(0, DMdata->GetEntries());
 
 
 }
@@ -98,45 +115,78 @@ dataHandler::dataHandler(TString name, TString fileName, TString dmTree) : error
 dataHandler::~dataHandler(){
 
 	delete DMdata;
-	delete gs1s2w;
 
 }
 
 
 Long64_t dataHandler::getEntries(){
-  return gs1s2w->GetN(); }
+  return eventS1.size(); }
 
 double dataHandler::getSumOfWeights(){
   return sumOfWeights; }
 
 void dataHandler::getEntry(Long64_t entry) {
-  if(DMdata ==NULL)  Error("getEntry","No data is set.");
-  if(entry > getEntries() )  Error("getEntry"," Entry number outside range");  
-  s1=gs1s2w->GetX()[entry];
-  s2=gs1s2w->GetY()[entry];
-  weight=gs1s2w->GetZ()[entry];
+  if(entry < 0 || entry >= getEntries() )  Error("getEntry"," Entry number outside range");  
+  s1=eventS1[entry];
+  s2=eventS2[entry];
+  weight=eventWeight[entry];
 	
 }
 
+void dataHandler::clearEvents(size_t size){
+
+	clearBinCache();
+
+	eventS1.clear();
+	eventS2.clear();
+	eventWeight.clear();
+	sumOfWeights = 0;
+
+	eventS1.reserve(size);
+	eventS2.reserve(size);
+	eventWeight.reserve(size);
+}
+
+void dataHandler::readEvents(Long64_t first, Long64_t entries){
+
+	clearEvents(entries);
+
+	DMdata->SetBranchAddress(FirstVarName,&s1);
+	DMdata->SetBranchAddress(SecondVarName,&s2);
+	TBranch *branchS1 = DMdata->GetBranch(FirstVarName);
+	TBranch *branchS2 = DMdata->GetBranch(SecondVarName);
+	if(branchS1 == NULL || branchS2 == NULL)
+		Error("readEvents", "TTree " + TString(DMdata->GetName()) + " has no " + FirstVarName + " or " + SecondVarName + " branch. Quit.");
+
+	// binned toys: each entry is a bin centre holding count events
+	int count = 1;
+	TBranch *branchCount = DMdata->GetBranch("count");
+	if(branchCount != NULL) DMdata->SetBranchAddress("count",&count);
+
+	// the other branches (true parameters, type...) are never unpacked
+	for (Long64_t i=first; i< first + entries; i++) {
+	   branchS1->GetEntry(i);
+	   branchS2->GetEntry(i);
+	   if(branchCount != NULL) branchCount->GetEntry(i);
+	   addEvent(s1, s2, count);
+	}
+
+	if(branchCount != NULL) DMdata->ResetBranchAddress(branchCount);
+}
+
 void dataHandler::generateAsimov( TH2F *background ){
+	// the store events tree is read again by the next setToyFromStore()
+	if( DMdata == storeEvents ) storeFile = NULL;
     delete DMdata;
-	delete gs1s2w;
-	double ts1 = 0., ts2 =0., tw = 0.;
-	DMdata = new TTree(Name,"FakeData "+Name);
-	DMdata->Branch(FirstVarName,&ts1);
-	DMdata->Branch(SecondVarName,&ts2);
-	DMdata->Branch("weight", &tw); 
-	gs1s2w=new TGraph2D();
-    sumOfWeights=0;
+	DMdata = NULL;
+	trueParamsLoaded = false;
+	clearEvents(background->GetNbinsX() * background->GetNbinsY());
 
 	for (int ix=1; ix<=background->GetNbinsX(); ix++) {
 	  for (int iy=1; iy<=background->GetNbinsY(); iy++) {
-	   ts1 = background->GetXaxis()->GetBinCenter(ix);
-	   ts2 = background->GetYaxis()->GetBinCenter(iy);
-	   tw=background->GetBinContent(ix,iy);
-	   DMdata->Fill();
-	   gs1s2w->SetPoint(gs1s2w->GetN(),ts1,ts2,tw);
-	   sumOfWeights+=tw;
+	   addEvent(background->GetXaxis()->GetBinCenter(ix),
+	            background->GetYaxis()->GetBinCenter(iy),
+	            background->GetBinContent(ix,iy));
 	  }
 	}
 }
@@ -215,8 +265,93 @@ void dataHandler::fillDataHisto(TH2F *hist){
 
 }
 
+vector<double> dataHandler::getBinningKey(TH2F *histo){
+
+	vector<double> key;
+	TAxis *axes[2] = { histo->GetXaxis(), histo->GetYaxis() };
+
+	for(int a=0; a < 2; a++){
+		int nbins = axes[a]->GetNbins();
+		key.push_back(nbins);
+		for(int b=1; b <= nbins +1; b++) key.push_back(axes[a]->GetBinLowEdge(b));
+	}
+
+	return key;
+}
+
+const vector<int>& dataHandler::getBinIndices(TH2F *histo){
+
+	if(histo == NULL)
+		Error("getBinIndices", "you passed me a NULL pointer, quit.");
+
+	if(lastBins != NULL && lastBinsTag.matches(histo)) return *lastBins;
+
+	// all templates of a likelihood share the binning, so typically this holds a single entry
+	vector<double> key = getBinningKey(histo);
+	lastBinsTag.set(histo);
+
+	map< vector<double>, vector<int> >::iterator it = binIndexCache.find(key);
+	if(it != binIndexCache.end()) {
+		lastBins = &it->second;
+		return it->second;
+	}
+
+	Long64_t Nentry = getEntries();
+	vector<int> &bins = binIndexCache[key];
+	lastBins = &bins;
+	bins.reserve(Nentry);
+
+	for(Long64_t event = 0; event < Nentry; event++)
+		bins.push_back(histo->FindBin(eventS1[event], eventS2[event]));
+
+	Debug("getBinIndices", TString::Format("cached bin indices of %lld events for %s", Nentry, Name.Data()));
+
+	return bins;
+}
+
+const vector<occupiedBin>& dataHandler::getOccupiedBins(TH2F *histo){
+
+	if(histo == NULL)
+		Error("getOccupiedBins", "you passed me a NULL pointer, quit.");
+
+	if(lastOccupied != NULL && lastOccupiedTag.matches(histo)) return *lastOccupied;
+
+	vector<double> key = getBinningKey(histo);
+
+	map< vector<double>, vector<occupiedBin> >::iterator it = occupiedBinCache.find(key);
+	if(it != occupiedBinCache.end()) {
+		lastOccupiedTag.set(histo);
+		lastOccupied = &it->second;
+		return it->second;
+	}
+
+	const vector<int> &bins = getBinIndices(histo);
+
+	// std::map keeps the bins sorted, so the likelihood walks the templates in memory order
+	map<int, occupiedBin> collapsed;
+	for(unsigned int event = 0; event < bins.size(); event++){
+		occupiedBin &ob = collapsed[bins[event]];
+		ob.bin           = bins[event];
+		ob.entries      += 1.;
+		ob.sumOfWeights += eventWeight[event];
+	}
+
+	vector<occupiedBin> &occupied = occupiedBinCache[key];
+	lastOccupiedTag.set(histo);
+	lastOccupied = &occupied;
+	occupied.reserve(collapsed.size());
+	for(map<int, occupiedBin>::iterator itr = collapsed.begin(); itr != collapsed.end(); ++itr)
+		occupied.push_back(itr->second);
+
+	Debug("getOccupiedBins", TString::Format("%u events of %s fall in %u bins", (unsigned int) bins.size(), Name.Data(), (unsigned int) occupied.size()));
+
+	return occupied;
+}
+
 vector<double> dataHandler::getTrueParams(){
 
+	if(trueParamsLoaded) return loadedTrueParams;
+
     // retrive the previously saved TList of parameters (done in ToyGenerator)
     TIter iterateMe(DMdata->GetUserInfo());
 
@@ -225,7 +360,7 @@ vector<double> dataHandler::getTrueParams(){
 	true_params.clear();
 
 	// if not MC toys then does not have truth so return empty
-	if(DMdata->GetUserInfo()->IsEmpty()) return true_params;
+	if(DMdata == NULL || DMdata->GetUserInfo()->IsEmpty()) return true_params;
 
     // saving the parameters of the tree
     while ((parameter = (TParameter<double>*)iterateMe())) {
@@ -236,6 +371,8 @@ vector<double> dataHandler::getTrueParams(){
 
 vector<string> dataHandler::getTrueParamsNames(){
 
+	if(trueParamsLoaded) return loadedTrueParamNames;
+
     // retrive the previously saved TList of parameters (done in ToyGenerator)
     TIter iterateMe(DMdata->GetUserInfo());
 
@@ -244,7 +381,7 @@ vector<string> dataHandler::getTrueParamsNames(){
 	true_params.clear();
 	
 	// if not MC toys then does not have truth so return empty
-	if(DMdata->GetUserInfo()->IsEmpty()) return true_params;
+	if(DMdata == NULL || DMdata->GetUserInfo()->IsEmpty()) return true_params;
 
     // saving the parameters of the tree
     while ((parameter = (TParameter<double>*)iterateMe())) {
@@ -257,11 +394,99 @@ vector<string> dataHandler::getTrueParamsNames(){
 void dataHandler::setTreeIndex( int index ){
 	if( TreePrefix == "" ) Error( "setTreeIndex", "Tree Prefix not set, use setPrefixTree().");
 	
+	if( file != NULL && file->FindKey(TreePrefix + "_index") != NULL ) {
+		setToyFromStore(index);
+		return;
+	}
+
 	TString newTree =  TreePrefix + "_" +TString::Itoa(index, 10);
 	Debug("setTreeIndex", "setting new tree: " + newTree);
 	setDataTree(newTree);
 }
 
+void dataHandler::loadToyStore(){
+
+	if( storeFile == file && storePrefix == TreePrefix ) return;
+
+	TTree *index = (TTree*) file->Get(TreePrefix + "_index");
+
+	int      toyItr = 0, nParams = 0;
+	Long64_t first = 0, entries = 0;
+	vector<double> params( TMath::Max(index->GetMaximum("n_params"), 1.) );
+	index->SetBranchAddress("toyItr", &toyItr);
+	index->SetBranchAddress("first", &first);
+	index->SetBranchAddress("entries", &entries);
+	index->SetBranchAddress("n_params", &nParams);
+	index->SetBranchAddress("true_params", &params[0]);
+
+	storePosition.clear();
+	storeFirst.clear();
+	storeEntries.clear();
+	storeParams.clear();
+	for(Long64_t i=0; i < index->GetEntries(); i++) {
+		index->GetEntry(i);
+		storePosition[toyItr] = i;
+		storeFirst.push_back(first);
+		storeEntries.push_back(entries);
+		storeParams.push_back(vector<double>(params.begin(), params.begin() + nParams));
+	}
+
+	storeParamNames.clear();
+	TIter iterateMe(index->GetUserInfo());
+	TObject *name = NULL;
+	while ((name = iterateMe())) storeParamNames.push_back(name->GetName());
+
+	delete index;
+
+	storeFile   = file;
+	storePrefix = TreePrefix;
+	storeEvents = (TTree*) file->Get(TreePrefix);
+	if( storeEvents == NULL ) Error("loadToyStore", "TTree " + TreePrefix + " does not exist in file " + file->GetName() + ". Quit.");
+
+	Debug("loadToyStore", TString::Format("%u toys in %s", (unsigned int) storeFirst.size(), TreePrefix.Data()));
+}
+
+void dataHandler::setToyFromStore( int index ){
+
+	loadToyStore();
+
+	map<int, int>::iterator it = storePosition.find(index);
+	if( it == storePosition.end() ) Error("setToyFromStore", TString::Format("toy %d not in %s. Quit.", index, TreePrefix.Data()));
+
+	Name = TString("Data_") + TreePrefix + "_" + TString::Itoa(index, 10);
+
+	int position = it->second;
+	trueParamsLoaded     = true;
+	loadedTrueParams     = storeParams[position];
+	loadedTrueParamNames = storeParamNames;
+
+	// DMdata may have been replaced (setDataTree, generateAsimov) since the store was loaded
+	DMdata = storeEvents;
+
+	// only the event range of the toy is read
+	dataType = DM_DATA;
+	readEvents(storeFirst[position], storeEntries[position]);
+}
+
+void dataHandler::setEvents( TString name, const vector<float> &cs1, const vector<float> &cs2, const vector<pair<TString,double> > &trueParams,
+                             const vector<int> &counts ){
+
+	Name = TString("Data_") + name;
+
+	trueParamsLoaded = !trueParams.empty();
+	loadedTrueParams.clear();
+	loadedTrueParamNames.clear();
+	for(unsigned int i=0; i < trueParams.size(); i++) {
+		loadedTrueParamNames.push_back(trueParams[i].first.Data());
+		loadedTrueParams.push_back(trueParams[i].second);
+	}
+
+	dataType = DM_DATA;
+	clearEvents(cs1.size());
+	for (unsigned int i=0; i< cs1.size(); i++)
+	   addEvent(cs1[i], cs2[i], counts.empty() ? 1. : counts[i]);
+}
+
 void dataHandler::setFileAndTree(TString PathtoFile, TString nameTree){
 	setFile(PathtoFile);
 	setDataTree(nameTree);
@@ -291,33 +516,23 @@ void dataHandler::setDataTree(TString nameTree){
 void dataHandler::setDataTree(TTree *tree){
 
 	//delete DMdata;  // no much reason to delete this, since adding from file or existing tree
-	delete gs1s2w;
+	trueParamsLoaded = false;
 
 	// changing name to the data handler
 	Name = TString("Data_") + tree->GetName();
 	
-	gs1s2w=new TGraph2D();
 	DMdata = tree;
 	
-	DMdata->SetBranchAddress(FirstVarName,&s1);
-	DMdata->SetBranchAddress(SecondVarName,&s2);
-	
 	dataType = DM_DATA;
-	sumOfWeights=0;
-	for (Long64_t i=0; i< DMdata->GetEntries(); i++) {
-	   weight = 1.;
-	   DMdata->GetEntry(i);
-	   gs1s2w->SetPoint(gs1s2w->GetN(),s1,s2,weight);
-	   sumOfWeights+=weight;
-	}
+	readEvents(0, DMdata->GetEntries());
 }
 
 void dataHandler::generateDataSet(TH2F *h2pdf, int N){
+  if( DMdata == storeEvents ) storeFile = NULL;
   delete DMdata;
-  delete gs1s2w;
-  sumOfWeights=0;
-  gs1s2w=new TGraph2D();
-  DMdata = new TNtuple(Name,"FakeData "+Name,FirstVarName+":"+SecondVarName+":weight"); 
+  DMdata = NULL;
+  trueParamsLoaded = false;
+  clearEvents(N);
   dataType = DM_SIMULATED_DATA;
   Name="Fake data set:";
   addToDataSet(h2pdf,N);
@@ -329,17 +544,13 @@ void dataHandler::addToDataSet(TH2F *h2pdf, int N){
   dataType = DM_SIMULATED_DATA;
   if(dataType != DM_SIMULATED_DATA)
     Error("addTodataSet","Cannot add fake data to this data set. Use generateDataSet first");
-  double ts1,ts2,tw = 0.;
-  DMdata->SetBranchAddress(FirstVarName,&ts1);
-  DMdata->SetBranchAddress(SecondVarName,&ts2);
+  double ts1,ts2 = 0.;
   Name+=Form("%s(%d),",h2pdf->GetName(),N);
+  clearBinCache();
   gRandom->SetSeed(0);
   for (int i=0; i<N; i++) {
     h2pdf->GetRandom2(ts1,ts2);
-    tw=1;
-    DMdata->Fill();
-    gs1s2w->SetPoint(gs1s2w->GetN(),ts1,ts2,tw);
-    sumOfWeights+=tw;
+    addEvent(ts1,ts2,1.);
   }
   
 
@@ -348,10 +559,8 @@ void dataHandler::addToDataSet(TH2F *h2pdf, int N){
 
 void dataHandler::drawS1S2(TString opt) {
 
-  if(DMdata != NULL){
-    DMdata->Draw(FirstVarName+":"+SecondVarName,"","goff");
-    TGraph *gr=new TGraph(DMdata->GetSelectedRows(),
-			  DMdata->GetV1(), DMdata->GetV2());
+  if(getEntries() > 0){
+    TGraph *gr=new TGraph(getS1S2());
     gr->SetTitle(Name+";"+FirstVarName+";"+SecondVarName);
     gr->Draw(opt);
   }
@@ -361,8 +570,8 @@ void dataHandler::drawS1S2(TString opt) {
 
 TGraph dataHandler::getS1S2() {
   TGraph gr;
- if (DMdata != NULL){
-   gr = TGraph(gs1s2w->GetN(), gs1s2w->GetX(),gs1s2w->GetY());
+ if (getEntries() > 0){
+   gr = TGraph(getEntries(), &eventS1[0], &eventS2[0]);
    }
 
 return gr;
@@ -371,7 +580,7 @@ return gr;
 
 void dataHandler::printSummary() {
 
-  printf ("dataHandler:: summary:  name= %s,  N=%d \n", Name.Data(),gs1s2w->GetN());
+  printf ("dataHandler:: summary:  name= %s,  N=%lld \n", Name.Data(),getEntries());
   return; 
 
 }
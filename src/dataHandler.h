@@ -7,10 +7,13 @@
 #include "TGraph2D.h"
 #include "TNtuple.h"
 #include "TParameter.h"
+#include "TObjString.h"
 #include <cmath>
 #include <csignal>
 #include <iostream>
 #include <vector>
+#include <map>
+#include <atomic>
 #include <utility>      // std::pair, std::make_pair
 
 enum DATA_TYPE { 
@@ -31,6 +34,62 @@ enum DATA_TYPE {
 using namespace std;
 
 
+/**
+ * \struct occupiedBin
+ * \brief a template bin holding at least one event, with the number of events and their summed weight.
+ */
+struct occupiedBin {
+	int    bin;           //! global bin in the template binning
+	double entries;       //! number of events in the bin
+	double sumOfWeights;  //! sum of the event weights in the bin
+};
+
+
+/**
+ * \struct binningTag
+ * \brief cheap identification of a template binning: the histo and its axes, no bin edges.
+ */
+struct binningTag {
+	TH2F   *histo;
+	int     nx, ny;
+	double  xmin, xmax, ymin, ymax;
+
+	binningTag() : histo(NULL), nx(0), ny(0), xmin(0.), xmax(0.), ymin(0.), ymax(0.) {};
+
+	void set(TH2F *h) {
+		histo = h;
+		nx    = h->GetNbinsX();  ny   = h->GetNbinsY();
+		xmin  = h->GetXaxis()->GetXmin();  xmax = h->GetXaxis()->GetXmax();
+		ymin  = h->GetYaxis()->GetXmin();  ymax = h->GetYaxis()->GetXmax();
+	};
+
+	bool matches(TH2F *h) const {
+		return h == histo && h->GetNbinsX() == nx && h->GetNbinsY() == ny
+		       && h->GetXaxis()->GetXmin() == xmin && h->GetXaxis()->GetXmax() == xmax
+		       && h->GetYaxis()->GetXmin() == ymin && h->GetYaxis()->GetXmax() == ymax;
+	};
+};
+
+
+/**
+ * \struct columnSpan
+ * \brief read only view of an event column, with no bounds check: meant for the likelihood loops.
+ *
+ * It stays valid until the events of the dataHandler change.
+ */
+template <typename T> struct columnSpan {
+	const T *ptr;
+	size_t   n;
+
+	columnSpan(const vector<T> &v) : ptr(v.empty() ? NULL : &v[0]), n(v.size()) {};
+
+	const T& operator[](size_t i) const { return ptr[i]; };
+	const T* data()  const { return ptr; };
+	size_t   size()  const { return n; };
+	const T* begin() const { return ptr; };
+	const T* end()   const { return ptr + n; };
+};
+
 
 
 class dataHandler : public errorHandler{
@@ -74,15 +133,33 @@ class dataHandler : public errorHandler{
 
 	    void  drawS1S2(TString opt="");
 
-	    TGraph2D *gs1s2w;
+	    //------ events, one contiguous column per variable ------//
+	    vector<float>  eventS1;
+	    vector<float>  eventS2;
+	    vector<double> eventWeight;
+	    //---------------------------------------------------------//
 
 	    double sumOfWeights;
 
 	    vector<int> getSimulatedInfo(unsigned int size);
 	    
-	    double getS1(int N) { if (N>gs1s2w->GetN()) {printf ("ERROR %d larger than Entries (%d) \n",N,gs1s2w->GetN()); return 0;} else return (gs1s2w->GetX()[N]); }
-	    double getS2(int N) { if (N>gs1s2w->GetN()) {printf ("ERROR %d larger than Entries (%d) \n",N,gs1s2w->GetN()); return 0;} else return (gs1s2w->GetY()[N]); }
-	    double getW(int N) { if (N>gs1s2w->GetN()) {printf ("ERROR %d larger than Entries (%d) \n",N,gs1s2w->GetN()); return 0;} else return (gs1s2w->GetZ()[N]); }
+	    // checked accessors, the likelihood loops use the columns below
+	    double getS1(Long64_t N) { if (N>=getEntries()) {printf ("ERROR %lld larger than Entries (%lld) \n",N,getEntries()); return 0;} else return eventS1[N]; }
+	    double getS2(Long64_t N) { if (N>=getEntries()) {printf ("ERROR %lld larger than Entries (%lld) \n",N,getEntries()); return 0;} else return eventS2[N]; }
+	    double getW(Long64_t N)  { if (N>=getEntries()) {printf ("ERROR %lld larger than Entries (%lld) \n",N,getEntries()); return 0;} else return eventWeight[N]; }
+
+	    //! \brief unchecked views of the event columns.
+	    columnSpan<float>  getS1Column()     const { return columnSpan<float>(eventS1); };
+	    columnSpan<float>  getS2Column()     const { return columnSpan<float>(eventS2); };
+	    columnSpan<double> getWeightColumn() const { return columnSpan<double>(eventWeight); };
+
+	    //! \brief drops the events, reserving room for size new ones.
+	    void clearEvents(size_t size = 0);
+
+	    void addEvent(float x, float y, double w) { eventS1.push_back(x); eventS2.push_back(y); eventWeight.push_back(w); sumOfWeights += w; };
+
+	    //! \brief reads the entries [first, first + entries) of DMdata, only the cs1, cs2 (and count) branches.
+	    void readEvents(Long64_t first, Long64_t entries);
 	    
 	    TGraph getS1S2();
 		
@@ -120,8 +197,19 @@ class dataHandler : public errorHandler{
 	   void setPrefixTree( TString prefix ) { TreePrefix = prefix ; } ;
 
 		//! \brief load the tree in file according to the name convention: "TreePrefix"+"index"
+		//
+		//! If the file holds a toy store (trees "TreePrefix" and "TreePrefix_index", see
+		//! ToyGenerator::setToyStore) the toy is read from its event range in the store instead.
 		void setTreeIndex( int index );	
 
+	   //! \brief takes the events (weight 1) and their true parameters from memory, with no tree.
+	   //
+	   //! name identifies the dataset, like the tree name would. Used to hand generated toys straight
+	   //! to the fit (see ToyFitterExclusion::fitGenerated).
+	   //! counts, if not empty, are the weights of the points of a binned toy (see ToyGenerator::setBinnedToys).
+	   void setEvents( TString name, const vector<float> &cs1, const vector<float> &cs2, const vector<pair<TString,double> > &trueParams,
+	                   const vector<int> &counts = vector<int>() );
+
 	   //change the  file and tree in one go.
 	   void   setFileAndTree(TString PathtoFile, TString nameTree); 
 
@@ -133,6 +221,63 @@ class dataHandler : public errorHandler{
 	   //! \brief useful to get the truth generated value of parameter stored in tree
 	   vector<double> getTrueParams();
 
+	   //! \brief returns the global bin of each event in the binning of histo.
+	   //
+	   //! The events and the template binning do not change during a fit, so the
+	   //! axis search is done once per (dataset, binning) and cached until the events change.
+	   const vector<int>& getBinIndices(TH2F *histo);
+
+	   //! \brief drops the cached bin indices, must be called whenever the events change.
+	   void clearBinCache() { binIndexCache.clear(); occupiedBinCache.clear(); lastBins = NULL; lastOccupied = NULL; eventsVersion = ++lastVersion; };
+
+	   //! \brief returns a number that changes every time the events change, unique among all dataHandlers.
+	   unsigned long getVersion() { return eventsVersion; };
+
+	   //! \brief returns the bins of histo that hold at least one event, sorted by bin.
+	   //
+	   //! Events falling in the same bin see the same template value, so a binned
+	   //! likelihood loops over these instead of the events. Cached like getBinIndices().
+	   const vector<occupiedBin>& getOccupiedBins(TH2F *histo);
+
+	   //! \brief returns a key identifying the binning (all the bin edges) of histo.
+	   static vector<double> getBinningKey(TH2F *histo);
+
+	   //! \brief reads the index of the toy store of TreePrefix in file, once per (file, prefix).
+	   void loadToyStore();
+
+	   //! \brief loads toy index from the toy store.
+	   void setToyFromStore( int index );
+
+	   //------ toy store, see setTreeIndex() ------//
+	   TFile                  *storeFile;        //! file and prefix of the loaded index
+	   TString                 storePrefix;
+	   TTree                  *storeEvents;      //! events tree of the store
+	   map<int, int>           storePosition;    //! position in the index of each toy
+	   vector<Long64_t>        storeFirst;       //! first event of each toy in the events tree
+	   vector<Long64_t>        storeEntries;     //! number of events of each toy
+	   vector< vector<double> > storeParams;     //! true parameters of each toy
+	   vector<string>          storeParamNames;
+	   //--------------------------------------------//
+
+	   bool                    trueParamsLoaded; //! true params of the events from a store or setEvents(), not from the tree UserInfo
+	   vector<double>          loadedTrueParams;
+	   vector<string>          loadedTrueParamNames;
+
+	   map< vector<double>, vector<int> > binIndexCache;  //! bin index of each event, per template binning
+
+	   map< vector<double>, vector<occupiedBin> > occupiedBinCache;  //! occupied bins, per template binning
+
+	   // the likelihood asks again and again for the same binning: the last answer is kept
+	   // and returned without building the key of getBinningKey()
+	   binningTag                  lastBinsTag;
+	   const vector<int>          *lastBins;      //! entry of binIndexCache for lastBinsTag, NULL if none
+	   binningTag                  lastOccupiedTag;
+	   const vector<occupiedBin>  *lastOccupied;  //! entry of occupiedBinCache for lastOccupiedTag, NULL if none
+
+	   unsigned long eventsVersion;
+
+	   static std::atomic<unsigned long> lastVersion;  //! shared by all dataHandlers, which can be loaded on concurrent threads
+
 
 };
 